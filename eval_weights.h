@@ -0,0 +1,7 @@
+﻿// 评估权重，由 finalamazon --tune 生成，不要手工修改
+// 90672 个局面，均方误差 0.185586
+#pragma once
+
+// EVAL_SCALE 相当于一个空格的分值
+constexpr int EVAL_SCALE = 16;
+constexpr int EVAL_WEIGHTS[] = { 6, 6, 6, -22 };
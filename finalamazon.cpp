@@ -10,28 +10,47 @@
 #include <algorithm>
 #include <fstream>
 #include <string>
+#include <sstream>
+#include <iterator>
 #include <limits>
 #include <chrono>
 #include <queue>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <random>
+#include <map>
+#include <set>
+#include <bit>
+#include <type_traits>
+#include <array>
 #include <graphics.h>
 #include <windows.h>
 #include <mmsystem.h>
 #include <conio.h>
+#include "eval_weights.h"
+#if !defined(AMAZONS_NO_SIMD) && (defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || defined(_M_IX86_FP))
+#include <immintrin.h>
+#endif
 #pragma comment(lib, "winmm.lib")
 
 using namespace std;
 
-const int BOARD_SIZE = 8;
+const int DEFAULT_BOARD_SIZE = 8;
+const int MAX_BOARD_SIZE = 10;
 const int AI_SEARCH_DEPTH = 2;
 const int CELL_SIZE = 60;
 const int BOARD_PADDING = 30;
-const int WINDOW_SIZE = BOARD_SIZE * CELL_SIZE + 2 * BOARD_PADDING;
 const int BUTTON_WIDTH = 120;
 const int BUTTON_HEIGHT = 40;
 const int BUTTON_GAP = 20;
-const int BUTTON_AREA_X = WINDOW_SIZE + 20;
 const int BUTTON_AREA_Y = 50;
 const string SAVE_FILE_NAME = "amazons_save.dat";
+const string BOOK_FILE_NAME = "amazons_book.bin";
 
 enum Piece
 {
@@ -63,56 +82,188 @@ struct Button
 
 typedef vector<vector<int>> Board;
 
+//棋盘大小由启动参数或存档决定（8 或 10），窗口布局随之计算
+int boardSize = DEFAULT_BOARD_SIZE;
+int windowSize = DEFAULT_BOARD_SIZE * CELL_SIZE + 2 * BOARD_PADDING;
+int buttonAreaX = windowSize + 20;
+int statusTop = windowSize - BOARD_PADDING + 2;
+
+//界面线程和 AI 线程都会写日志，整行写入期间持锁，各行不会交错
+mutex logLock;
+
 void logDebug(const string& msg)
 {
+    lock_guard<mutex> guard(logLock);
     ofstream ofs("amazons_debug.log", ios::app | ios::binary);
     if (!ofs.is_open())
         return;
     ofs << msg << "\n";
 }
 
-void showTempMessage(const wchar_t* msg, int ms = 800)
+struct DirtyRect
+{
+    int left, top, right, bottom;
+    bool any;
+};
+
+DirtyRect dirtyRect = { 0, 0, 0, 0, false };
+
+void markDirty(int left, int top, int right, int bottom)
+{
+    if (!dirtyRect.any)
+    {
+        dirtyRect = { left, top, right, bottom, true };
+        return;
+    }
+    dirtyRect.left = min(dirtyRect.left, left);
+    dirtyRect.top = min(dirtyRect.top, top);
+    dirtyRect.right = max(dirtyRect.right, right);
+    dirtyRect.bottom = max(dirtyRect.bottom, bottom);
+}
+
+void presentFrame()
+{
+    if (!dirtyRect.any)
+        return;
+    FlushBatchDraw(dirtyRect.left, dirtyRect.top, dirtyRect.right, dirtyRect.bottom);
+    dirtyRect.any = false;
+}
+
+//帧调度：动画、提示、特效都是按帧推进的定时任务，主循环从不阻塞
+const int FRAME_MS = 16;
+
+struct FrameTask
+{
+    DWORD start;
+    int duration;
+    bool cancellable;
+    function<void(double)> onFrame;
+    function<void()> onDone;
+};
+
+vector<FrameTask> frameTasks;
+
+DWORD frameClockMs()
+{
+    static const auto origin = chrono::steady_clock::now();
+    return (DWORD)chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - origin).count();
+}
+
+void scheduleTask(int duration, function<void(double)> onFrame, function<void()> onDone = nullptr,
+    bool cancellable = true)
+{
+    frameTasks.push_back({ frameClockMs(), duration, cancellable, onFrame, onDone });
+}
+
+//新游戏/读盘时丢弃属于旧局面的动画与特效，提示信息保留
+void cancelFrameTasks()
+{
+    vector<FrameTask> kept;
+    for (auto& task : frameTasks)
+        if (!task.cancellable)
+            kept.push_back(std::move(task));
+    frameTasks.swap(kept);
+}
+
+void advanceFrameTasks()
+{
+    DWORD now = frameClockMs();
+    vector<FrameTask> running;
+    running.swap(frameTasks);
+    for (auto& task : running)
+    {
+        double t = task.duration > 0 ? min(1.0, (now - task.start) / (double)task.duration) : 1.0;
+        if (task.onFrame)
+            task.onFrame(t);
+        if (t >= 1.0)
+        {
+            if (task.onDone)
+                task.onDone();
+        }
+        else
+            frameTasks.push_back(std::move(task));
+    }
+}
+
+//状态栏：常驻提示 + 临时提示，临时提示到期后恢复常驻提示
+wstring statusText;
+wstring toastText;
+int toastSerial = 0;
+
+void paintStatusStrip()
 {
+    bool toast = !toastText.empty();
     setfillcolor(WHITE);
-    solidrectangle(0, WINDOW_SIZE - 40, WINDOW_SIZE, WINDOW_SIZE);
+    solidrectangle(0, statusTop, windowSize, windowSize);
     settextcolor(BLACK);
-    settextstyle(18, 0, _T("宋体"));
-    outtextxy(10, WINDOW_SIZE - 30, (TCHAR*)msg);
-    FlushBatchDraw();
-    Sleep(ms);
+    settextstyle(toast ? 18 : 20, 0, _T("宋体"));
+    outtextxy(10, windowSize - 25, (TCHAR*)(toast ? toastText : statusText).c_str());
+    markDirty(0, statusTop, windowSize, windowSize);
+}
 
-    setfillcolor(WHITE);
-    solidrectangle(0, WINDOW_SIZE - 40, WINDOW_SIZE, WINDOW_SIZE);
-    FlushBatchDraw();
+void drawStatusText(const TCHAR* text)
+{
+    if (statusText == text)
+        return;
+    statusText = text;
+    if (toastText.empty())
+        paintStatusStrip();
+}
+
+void showTempMessage(const wchar_t* msg, int ms = 800)
+{
+    toastText = msg;
+    int serial = ++toastSerial;
+    paintStatusStrip();
+    scheduleTask(ms, nullptr, [serial]()
+        {
+            if (serial != toastSerial)
+                return;
+            toastText.clear();
+            paintStatusStrip();
+        }, false);
+}
+
+vector<Button> buttons;
+
+const wchar_t* const BUTTON_TEXTS[] = { L"存盘", L"读盘", L"新游戏", L"结束游戏", L"悔棋", L"重做" };
+
+bool isSupportedBoardSize(int size)
+{
+    return size == 8 || size == 10;
 }
 
-vector<Button> buttons = {
-    {BUTTON_AREA_X, BUTTON_AREA_Y + 0 * (BUTTON_HEIGHT + BUTTON_GAP),
-     BUTTON_WIDTH, BUTTON_HEIGHT, L"存盘"},
-    {BUTTON_AREA_X, BUTTON_AREA_Y + 1 * (BUTTON_HEIGHT + BUTTON_GAP),
-     BUTTON_WIDTH, BUTTON_HEIGHT, L"读盘"},
-    {BUTTON_AREA_X, BUTTON_AREA_Y + 2 * (BUTTON_HEIGHT + BUTTON_GAP),
-     BUTTON_WIDTH, BUTTON_HEIGHT, L"新游戏"},
-    {BUTTON_AREA_X, BUTTON_AREA_Y + 3 * (BUTTON_HEIGHT + BUTTON_GAP),
-     BUTTON_WIDTH, BUTTON_HEIGHT, L"结束游戏"} };
+void setBoardSize(int size)
+{
+    boardSize = size;
+    windowSize = size * CELL_SIZE + 2 * BOARD_PADDING;
+    buttonAreaX = windowSize + 20;
+    statusTop = windowSize - BOARD_PADDING + 2;
+    buttons.clear();
+    for (int i = 0; i < 6; ++i)
+        buttons.push_back({ buttonAreaX, BUTTON_AREA_Y + i * (BUTTON_HEIGHT + BUTTON_GAP),
+            BUTTON_WIDTH, BUTTON_HEIGHT, BUTTON_TEXTS[i] });
+}
 
 //基础函数
-bool isInside(int r, int c)
+bool isInside(int r, int c, int size = boardSize)
 {
-    return r >= 0 && r < BOARD_SIZE && c >= 0 && c < BOARD_SIZE;
+    return r >= 0 && r < size && c >= 0 && c < size;
 }
 
-Board initializeBoard()
+//8x8 与 10x10 的标准开局：每方四个皇后分别在底线和边线上距角 (size-1)/3 格处
+Board initializeBoard(int size = boardSize)
 {
-    Board board(BOARD_SIZE, vector<int>(BOARD_SIZE, EMPTY));
-    board[0][2] = WHITE_QUEEN;
-    board[0][5] = WHITE_QUEEN;
-    board[2][0] = WHITE_QUEEN;
-    board[2][7] = WHITE_QUEEN;
-    board[7][2] = BLACK_QUEEN;
-    board[7][5] = BLACK_QUEEN;
-    board[5][0] = BLACK_QUEEN;
-    board[5][7] = BLACK_QUEEN;
+    Board board(size, vector<int>(size, EMPTY));
+    int near = (size - 1) / 3, far = size - 1 - near, side = near;
+    board[0][near] = WHITE_QUEEN;
+    board[0][far] = WHITE_QUEEN;
+    board[side][0] = WHITE_QUEEN;
+    board[side][size - 1] = WHITE_QUEEN;
+    board[size - 1][near] = BLACK_QUEEN;
+    board[size - 1][far] = BLACK_QUEEN;
+    board[size - 1 - side][0] = BLACK_QUEEN;
+    board[size - 1 - side][size - 1] = BLACK_QUEEN;
     return board;
 }
 
@@ -137,7 +288,7 @@ bool isMovePathValid(const Position& start, const Position& end,
 
     while (r != end.row || c != end.col)
     {
-        if (!isInside(r, c))
+        if (!isInside(r, c, (int)board.size()))
             return false;
 
         if (board[r][c] != EMPTY &&
@@ -172,19 +323,21 @@ void makeMove(Board& board, const Move& move, Piece current_player, bool execute
     board[move.arrow_pos.row][move.arrow_pos.col] = ARROW;
 }
 
+//箭可能射回起点，必须先清箭再放回皇后
 void undoMove(Board& board, const Move& move, Piece current_player)
 {
+    board[move.arrow_pos.row][move.arrow_pos.col] = EMPTY;
     board[move.queen_end.row][move.queen_end.col] = EMPTY;
     board[move.queen_start.row][move.queen_start.col] = current_player;
-    board[move.arrow_pos.row][move.arrow_pos.col] = EMPTY;
 }
 
 //移动验证
 bool isMoveValid(const Move& move, const Board& board, Piece current_player)
 {
-    if (!isInside(move.queen_start.row, move.queen_start.col) ||
-        !isInside(move.queen_end.row, move.queen_end.col) ||
-        !isInside(move.arrow_pos.row, move.arrow_pos.col))
+    int size = (int)board.size();
+    if (!isInside(move.queen_start.row, move.queen_start.col, size) ||
+        !isInside(move.queen_end.row, move.queen_end.col, size) ||
+        !isInside(move.arrow_pos.row, move.arrow_pos.col, size))
         return false;
 
     if (board[move.queen_start.row][move.queen_start.col] != current_player)
@@ -209,799 +362,5175 @@ bool isMoveValid(const Move& move, const Board& board, Piece current_player)
     return true;
 }
 
-//移动生成
-vector<Move> getValidMovesForQueen(const Position& start_pos, const Board& board, Piece current_player)
+//皇后走到相邻的空格后总能把箭射回原位，所以有着法当且仅当某个皇后周围有空格，找到一个就返回
+bool hasAnyValidMove(const Board& board, Piece current_player)
 {
-    vector<Move> valid_moves;
     int directions[8][2] = { {0, 1}, {0, -1}, {1, 0}, {-1, 0}, {1, 1}, {-1, -1}, {1, -1}, {-1, 1} };
-
-    if (board[start_pos.row][start_pos.col] != current_player)
-        return valid_moves;
-
-    for (int i = 0; i < 8; ++i)
+    int size = (int)board.size();
+    for (int r = 0; r < size; ++r)
     {
-        int dr = directions[i][0], dc = directions[i][1];
-        for (int step = 1;; ++step)
+        for (int c = 0; c < size; ++c)
         {
-            Position queen_end = { start_pos.row + dr * step, start_pos.col + dc * step };
-            if (!isInside(queen_end.row, queen_end.col))
-                break;
-            if (!isMovePathValid(start_pos, queen_end, board))
-                break;
-
-            Board temp_board = board;
-            temp_board[start_pos.row][start_pos.col] = EMPTY;
-            temp_board[queen_end.row][queen_end.col] = current_player;
-
-            for (int j = 0; j < 8; ++j)
+            if (board[r][c] != current_player)
+                continue;
+            for (int i = 0; i < 8; ++i)
             {
-                int ar = directions[j][0], ac = directions[j][1];
-                for (int arrow_step = 1;; ++arrow_step)
-                {
-                    Position arrow_pos = { queen_end.row + ar * arrow_step,
-                                          queen_end.col + ac * arrow_step };
-                    if (!isInside(arrow_pos.row, arrow_pos.col))
-                        break;
-                    if (isMovePathValid(queen_end, arrow_pos, temp_board, queen_end))
-                        valid_moves.push_back({ start_pos, queen_end, arrow_pos });
-                    else
-                        break;
-                }
+                int nr = r + directions[i][0], nc = c + directions[i][1];
+                if (isInside(nr, nc, size) && board[nr][nc] == EMPTY)
+                    return true;
             }
         }
     }
-    return valid_moves;
+    return false;
+}
+
+bool checkGameOver(const Board& board, Piece current_player)
+{
+    return !hasAnyValidMove(board, current_player);
+}
+
+//棋谱：着法按 起点 | 终点 << 8 | 箭 << 16 打包，格子编号为 row * 棋盘大小 + col
+//引擎内部也直接使用这种表示
+typedef uint32_t PackedMove;
+
+PackedMove packMove(const Move& move, int size = boardSize)
+{
+    return (PackedMove)(move.queen_start.row * size + move.queen_start.col) |
+        (PackedMove)(move.queen_end.row * size + move.queen_end.col) << 8 |
+        (PackedMove)(move.arrow_pos.row * size + move.arrow_pos.col) << 16;
+}
+
+Move unpackMove(PackedMove packed, int size = boardSize)
+{
+    int from = packed & 0xFF, to = (packed >> 8) & 0xFF, arrow = (packed >> 16) & 0xFF;
+    return { {from / size, from % size},
+             {to / size, to % size},
+             {arrow / size, arrow % size} };
+}
+
+Piece opponentOf(Piece player)
+{
+    return player == WHITE_QUEEN ? BLACK_QUEEN : WHITE_QUEEN;
+}
+
+struct GameRecord
+{
+    Board start_board;
+    Piece start_player;
+    vector<PackedMove> moves;
+    size_t ply;   //当前局面之前已走的步数，ply < moves.size() 时可以重做
+};
+
+void resetRecord(GameRecord& record, const Board& board, Piece player)
+{
+    record.start_board = board;
+    record.start_player = player;
+    record.moves.clear();
+    record.ply = 0;
+}
+
+Piece playerAtPly(const GameRecord& record, size_t ply)
+{
+    return ply % 2 == 0 ? record.start_player : opponentOf(record.start_player);
+}
+
+//走新的一步会丢弃所有可重做的着法
+void recordMove(GameRecord& record, const Move& move)
+{
+    record.moves.resize(record.ply);
+    record.moves.push_back(packMove(move));
+    record.ply++;
 }
 
-vector<Move> getAllValidMoves(const Board& board, Piece current_player)
+bool undoRecordedMove(GameRecord& record, Board& board, Piece& currentPlayer)
 {
-    vector<Move> all_moves;
-    for (int r = 0; r < BOARD_SIZE; ++r)
+    if (record.ply == 0)
+        return false;
+    record.ply--;
+    currentPlayer = playerAtPly(record, record.ply);
+    undoMove(board, unpackMove(record.moves[record.ply]), currentPlayer);
+    return true;
+}
+
+bool redoRecordedMove(GameRecord& record, Board& board, Piece& currentPlayer)
+{
+    if (record.ply >= record.moves.size())
+        return false;
+    makeMove(board, unpackMove(record.moves[record.ply]), currentPlayer, false);
+    record.ply++;
+    currentPlayer = playerAtPly(record, record.ply);
+    return true;
+}
+
+//二进制存档格式（小端）：
+//  0  char[4] "AMZR"
+//  4  u16     版本
+//  6  u8      棋盘大小
+//  7  u8      起始局面的行棋方
+//  8  u8      标志位，RECORD_FLAG_CUSTOM_START 表示后面附带起始局面
+//  9  u8      保留
+// 10  u16     保留
+// 12  u32     着法数
+// 16  u32     当前步数（其后的着法可以重做）
+// 20  [u8 × 大小²]  起始局面（仅当带有 RECORD_FLAG_CUSTOM_START）
+//     [u32 × 着法数] 打包着法
+//     u32     之前所有字节的 FNV-1a 校验和
+const char RECORD_MAGIC[4] = { 'A', 'M', 'Z', 'R' };
+const uint16_t RECORD_VERSION = 1;
+const uint8_t RECORD_FLAG_CUSTOM_START = 1;
+const size_t RECORD_HEADER_SIZE = 20;
+
+uint32_t fnv1a(const uint8_t* data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i)
     {
-        for (int c = 0; c < BOARD_SIZE; ++c)
-        {
-            if (board[r][c] == current_player)
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void putU16(vector<uint8_t>& out, uint16_t v)
+{
+    out.push_back(v & 0xFF);
+    out.push_back(v >> 8);
+}
+
+void putU32(vector<uint8_t>& out, uint32_t v)
+{
+    for (int i = 0; i < 4; ++i)
+        out.push_back((v >> (8 * i)) & 0xFF);
+}
+
+uint16_t getU16(const uint8_t* p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+uint32_t getU32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+vector<uint8_t> encodeRecord(const GameRecord& record)
+{
+    bool custom_start = record.start_board != initializeBoard();
+    vector<uint8_t> out(RECORD_MAGIC, RECORD_MAGIC + 4);
+    out.reserve(RECORD_HEADER_SIZE + boardSize * boardSize + record.moves.size() * 4 + 4);
+    putU16(out, RECORD_VERSION);
+    out.push_back((uint8_t)boardSize);
+    out.push_back((uint8_t)record.start_player);
+    out.push_back(custom_start ? RECORD_FLAG_CUSTOM_START : 0);
+    out.push_back(0);
+    putU16(out, 0);
+    putU32(out, (uint32_t)record.moves.size());
+    putU32(out, (uint32_t)record.ply);
+    if (custom_start)
+        for (int r = 0; r < boardSize; ++r)
+            for (int c = 0; c < boardSize; ++c)
+                out.push_back((uint8_t)record.start_board[r][c]);
+    for (PackedMove m : record.moves)
+        putU32(out, m);
+    putU32(out, fnv1a(out.data(), out.size()));
+    return out;
+}
+
+//校验并复现整盘棋，board 得到当前步数处的局面
+bool decodeRecord(const uint8_t* data, size_t size, GameRecord& record, Board& board, Piece& currentPlayer)
+{
+    if (size < RECORD_HEADER_SIZE + 4 || !equal(RECORD_MAGIC, RECORD_MAGIC + 4, data))
+        return false;
+    if (getU16(data + 4) != RECORD_VERSION)
+    {
+        cerr << "错误：不支持的存档版本 (" << getU16(data + 4) << ")。" << endl;
+        return false;
+    }
+    if (data[6] != boardSize)
+    {
+        cerr << "错误：存档文件中的棋盘大小不匹配 (" << (int)data[6] << ")。" << endl;
+        return false;
+    }
+    if (fnv1a(data, size - 4) != getU32(data + size - 4))
+    {
+        cerr << "错误：存档校验和不匹配。" << endl;
+        return false;
+    }
+
+    Piece start_player = (Piece)data[7];
+    bool custom_start = (data[8] & RECORD_FLAG_CUSTOM_START) != 0;
+    uint32_t move_count = getU32(data + 12);
+    uint32_t ply = getU32(data + 16);
+    size_t board_bytes = custom_start ? boardSize * boardSize : 0;
+    if ((start_player != WHITE_QUEEN && start_player != BLACK_QUEEN) || ply > move_count ||
+        size != RECORD_HEADER_SIZE + board_bytes + (size_t)move_count * 4 + 4)
+        return false;
+
+    GameRecord loaded;
+    Board start = initializeBoard();
+    const uint8_t* p = data + RECORD_HEADER_SIZE;
+    if (custom_start)
+    {
+        for (int r = 0; r < boardSize; ++r)
+            for (int c = 0; c < boardSize; ++c)
             {
-                Position queen_pos = { r, c };
-                vector<Move> queen_moves = getValidMovesForQueen(queen_pos, board, current_player);
-                all_moves.insert(all_moves.end(), queen_moves.begin(), queen_moves.end());
+                if (*p > ARROW)
+                    return false;
+                start[r][c] = *p++;
             }
+    }
+    resetRecord(loaded, start, start_player);
+    loaded.moves.resize(move_count);
+    for (uint32_t i = 0; i < move_count; ++i, p += 4)
+        loaded.moves[i] = getU32(p);
+
+    //整盘复现一遍以校验每一步都合法，再退回到存档时的步数
+    Board replay = start;
+    for (uint32_t i = 0; i < move_count; ++i)
+    {
+        Move move = unpackMove(loaded.moves[i]);
+        Piece player = playerAtPly(loaded, i);
+        if (!isMoveValid(move, replay, player))
+        {
+            cerr << "错误：存档第 " << i + 1 << " 步不合法。" << endl;
+            return false;
         }
+        makeMove(replay, move, player, false);
     }
-    return all_moves;
-}
+    loaded.ply = move_count;
+    Piece player = playerAtPly(loaded, move_count);
+    while (loaded.ply > ply)
+        undoRecordedMove(loaded, replay, player);
 
-bool checkGameOver(const Board& board, Piece current_player)
-{
-    return getAllValidMoves(board, current_player).empty();
+    record = loaded;
+    board = replay;
+    currentPlayer = player;
+    return true;
 }
 
 //存档
-bool saveGame(const Board& board, Piece currentPlayer)
+bool saveGame(const GameRecord& record)
 {
-    ofstream outFile(SAVE_FILE_NAME);
+    ofstream outFile(SAVE_FILE_NAME, ios::binary);
     if (!outFile.is_open())
     {
         cerr << "错误：无法打开文件 " << SAVE_FILE_NAME << " 进行保存。" << endl;
         return false;
     }
-    outFile << BOARD_SIZE << endl
-        << (int)currentPlayer << endl;
-    for (int r = 0; r < BOARD_SIZE; ++r)
-    {
-        for (int c = 0; c < BOARD_SIZE; ++c)
-            outFile << board[r][c] << " ";
-        outFile << endl;
-    }
+    vector<uint8_t> bytes = encodeRecord(record);
+    outFile.write((const char*)bytes.data(), bytes.size());
     outFile.close();
     logDebug(string("游戏已成功保存到文件: ") + SAVE_FILE_NAME);
     return true;
 }
 
-bool loadGame(Board& board, Piece& currentPlayer)
+//旧版文本存档：棋盘大小、行棋方、逐格数字；每个值都先检查范围，之后才会拿去做哈希表下标
+bool loadLegacyTextGame(const vector<uint8_t>& bytes, Board& board, Piece& currentPlayer)
 {
-    ifstream inFile(SAVE_FILE_NAME);
-    if (!inFile.is_open())
+    istringstream inFile(string(bytes.begin(), bytes.end()));
+    int loaded_size, loaded_player_int;
+    if (!(inFile >> loaded_size))
     {
-        showTempMessage(L"提示：找不到存档文件，将开始新游戏。", 1000);
+        cerr << "错误：存档文件开头不是棋盘大小。" << endl;
         return false;
     }
-    int loaded_size, loaded_player_int;
-    inFile >> loaded_size;
-    if (loaded_size != BOARD_SIZE)
+    if (!isSupportedBoardSize(loaded_size))
     {
-        cerr << "错误：存档文件中的棋盘大小不匹配 (" << loaded_size << ")。" << endl;
-        inFile.close();
+        cerr << "错误：不支持存档文件中的棋盘大小 (" << loaded_size << ")。" << endl;
         return false;
     }
-    inFile >> loaded_player_int;
-    currentPlayer = (Piece)loaded_player_int;
-    Board loaded_board(BOARD_SIZE, vector<int>(BOARD_SIZE));
-    for (int r = 0; r < BOARD_SIZE; ++r)
-        for (int c = 0; c < BOARD_SIZE; ++c)
+    if (!(inFile >> loaded_player_int) || (loaded_player_int != WHITE_QUEEN && loaded_player_int != BLACK_QUEEN))
+    {
+        cerr << "错误：存档文件中的行棋方无效。" << endl;
+        return false;
+    }
+    Board loaded_board(loaded_size, vector<int>(loaded_size));
+    for (int r = 0; r < loaded_size; ++r)
+        for (int c = 0; c < loaded_size; ++c)
+        {
             if (!(inFile >> loaded_board[r][c]))
             {
                 cerr << "错误：读取棋盘数据失败。" << endl;
-                inFile.close();
                 return false;
             }
-    inFile.close();
+            if (loaded_board[r][c] < EMPTY || loaded_board[r][c] > ARROW)
+            {
+                cerr << "错误：存档文件中的棋子无效 (" << loaded_board[r][c] << ")。" << endl;
+                return false;
+            }
+        }
     board = loaded_board;
-    showTempMessage(L"游戏已成功从存档加载。", 1000);
+    currentPlayer = (Piece)loaded_player_int;
     return true;
 }
 
-//图形界面
-void drawButtons()
+bool readFileBytes(const string& path, vector<uint8_t>& bytes)
 {
-    settextstyle(20, 0, _T("宋体"));
-    for (const auto& btn : buttons)
-    {
-        setlinecolor(BLACK);
-        setfillcolor(RGB(220, 220, 220));
-        fillrectangle(btn.x, btn.y, btn.x + btn.w, btn.y + btn.h);
-        settextcolor(BLACK);
-        outtextxy(btn.x + 15, btn.y + 10, (TCHAR*)btn.text);
-    }
+    ifstream inFile(path, ios::binary);
+    if (!inFile.is_open())
+        return false;
+    bytes.assign(istreambuf_iterator<char>(inFile), istreambuf_iterator<char>());
+    return true;
 }
 
-void printBoardGraphics(const Board& board)
+bool loadGame(GameRecord& record, Board& board, Piece& currentPlayer)
 {
-    cleardevice();
-
-    for (int r = 0; r < BOARD_SIZE; r++)
+    vector<uint8_t> bytes;
+    if (!readFileBytes(SAVE_FILE_NAME, bytes))
     {
-        for (int c = 0; c < BOARD_SIZE; c++)
-        {
-            int left = BOARD_PADDING + c * CELL_SIZE;
-            int top = BOARD_PADDING + r * CELL_SIZE;
-            COLORREF cellColor = ((r + c) % 2 == 0) ? RGB(240, 217, 181) : RGB(181, 136, 99);
-            setfillcolor(cellColor);
-            solidrectangle(left, top, left + CELL_SIZE, top + CELL_SIZE);
-        }
+        showTempMessage(L"提示：找不到存档文件，将开始新游戏。", 1000);
+        return false;
     }
 
-    setlinecolor(DARKGRAY);
-    setlinestyle(PS_SOLID, 2);
-    for (int i = 0; i <= BOARD_SIZE; ++i)
+    //存档决定棋盘大小，读取失败时恢复原来的大小
+    int previous_size = boardSize;
+    bool loaded;
+    if (bytes.size() >= 4 && equal(RECORD_MAGIC, RECORD_MAGIC + 4, bytes.data()))
     {
-        int pos = BOARD_PADDING + i * CELL_SIZE;
-        line(BOARD_PADDING, pos, WINDOW_SIZE - BOARD_PADDING, pos);
-        line(pos, BOARD_PADDING, pos, WINDOW_SIZE - BOARD_PADDING);
+        if (bytes.size() > 6 && isSupportedBoardSize(bytes[6]))
+            setBoardSize(bytes[6]);
+        loaded = decodeRecord(bytes.data(), bytes.size(), record, board, currentPlayer);
     }
-
-    for (int r = 0; r < BOARD_SIZE; r++)
+    else
     {
-        for (int c = 0; c < BOARD_SIZE; c++)
+        Board legacy_board;
+        loaded = loadLegacyTextGame(bytes, legacy_board, currentPlayer);
+        if (loaded)
         {
-            int center_x = BOARD_PADDING + c * CELL_SIZE + CELL_SIZE / 2;
-            int center_y = BOARD_PADDING + r * CELL_SIZE + CELL_SIZE / 2;
-            int radius = CELL_SIZE / 3;
-
-            switch (board[r][c])
-            {
-            case BLACK_QUEEN:
-                setfillcolor(RGB(220, 220, 220));
-                fillcircle(center_x, center_y, radius);
-                setfillcolor(RGB(255, 255, 255));
-                solidcircle(center_x - radius / 3, center_y - radius / 3, radius / 2);
-                break;
-            case WHITE_QUEEN:
-                setfillcolor(RGB(40, 40, 40));
-                fillcircle(center_x, center_y, radius);
-                setfillcolor(RGB(180, 180, 180));
-                solidcircle(center_x - radius / 3, center_y - radius / 3, radius / 2);
-                break;
-            case ARROW:
-                setfillcolor(RGB(100, 100, 100));
-                fillcircle(center_x, center_y, radius);
-                setfillcolor(RGB(180, 180, 180));
-                solidcircle(center_x - radius / 3, center_y - radius / 3, radius / 2);
-                break;
-            }
+            setBoardSize((int)legacy_board.size());
+            board = legacy_board;
+            resetRecord(record, board, currentPlayer);
         }
     }
-    settextcolor(BLACK);
-    settextstyle(20, 0, _T("宋体"));
-    outtextxy(10, WINDOW_SIZE - 25, _T("请在棋盘窗口操作按钮或走棋"));
-
-    drawButtons();
+    if (!loaded)
+    {
+        setBoardSize(previous_size);
+        showTempMessage(L"错误：存档文件损坏或不兼容。", 1000);
+        return false;
+    }
+    showTempMessage(L"游戏已成功从存档加载。", 1000);
+    return true;
 }
 
-void drawHighlight(Position p, COLORREF color)
+//局面哈希：Zobrist 键由固定种子生成，写进棋谱库/开局库的哈希在不同机器上一致
+uint64_t zobristKeys[MAX_BOARD_SIZE * MAX_BOARD_SIZE][4];
+uint64_t zobristBlackToMove;
+
+uint64_t splitMix64(uint64_t& state)
 {
-    int left = BOARD_PADDING + p.col * CELL_SIZE;
-    int top = BOARD_PADDING + p.row * CELL_SIZE;
-    setfillcolor(color);
-    solidrectangle(left + 1, top + 1, left + CELL_SIZE - 4, top + CELL_SIZE - 4);
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
 }
 
-void animateMove(const Position& start, const Position& end, Piece piece, const Board& board)
+bool initZobrist()
 {
-    int steps = 10;
-    int sx = BOARD_PADDING + start.col * CELL_SIZE + CELL_SIZE / 2;
-    int sy = BOARD_PADDING + start.row * CELL_SIZE + CELL_SIZE / 2;
-    int ex = BOARD_PADDING + end.col * CELL_SIZE + CELL_SIZE / 2;
-    int ey = BOARD_PADDING + end.row * CELL_SIZE + CELL_SIZE / 2;
-
-    for (int i = 1; i <= steps; ++i)
+    uint64_t state = 0x416D617A6F6E73ull;
+    for (int sq = 0; sq < MAX_BOARD_SIZE * MAX_BOARD_SIZE; ++sq)
     {
-        double t = i / (double)steps;
-        int x = sx + (ex - sx) * t;
-        int y = sy + (ey - sy) * t;
-        printBoardGraphics(board);
-
-        int radius = CELL_SIZE / 3;
-        if (piece == BLACK_QUEEN)
-        {
-            setfillcolor(RGB(220, 220, 220));
-            fillcircle(x, y, radius);
-        }
-        else
-        {
-            setfillcolor(RGB(40, 40, 40));
-            fillcircle(x, y, radius);
-        }
-        FlushBatchDraw();
-        Sleep(20);
+        zobristKeys[sq][EMPTY] = 0;
+        for (int piece = WHITE_QUEEN; piece <= ARROW; ++piece)
+            zobristKeys[sq][piece] = splitMix64(state);
     }
+    zobristBlackToMove = splitMix64(state);
+    return true;
 }
 
-//特效
-void showFireworks()
+const bool zobristReady = initZobrist();
+
+uint64_t hashBoard(const Board& board, Piece sideToMove)
 {
-    int cx = WINDOW_SIZE / 2, cy = WINDOW_SIZE / 2;
-    for (int t = 0; t < 30; ++t)
-    {
-        for (int i = 0; i < 40; ++i)
-        {
-            double angle = rand() * 2 * 3.14159 / RAND_MAX;
-            int r = 30 + t * 4;
-            int x = cx + (int)(r * cos(angle));
-            int y = cy + (int)(r * sin(angle));
-            setfillcolor(RGB(rand() % 256, rand() % 256, rand() % 256));
-            solidcircle(x, y, 4);
-        }
-        FlushBatchDraw();
-        Sleep(30);
-    }
+    uint64_t hash = sideToMove == BLACK_QUEEN ? zobristBlackToMove : 0;
+    int size = (int)board.size();
+    for (int r = 0; r < size; ++r)
+        for (int c = 0; c < size; ++c)
+            hash ^= zobristKeys[r * size + c][board[r][c]];
+    return hash;
 }
 
-void showBlinkText(const wchar_t* text, int x, int y)
+//增量更新，箭射回起点时同样成立
+uint64_t hashAfterMove(uint64_t hash, PackedMove move, Piece player)
 {
-    for (int i = 0; i < 8; ++i)
-    {
-        settextcolor(i % 2 == 0 ? RED : RGB(255, 215, 0));
-        settextstyle(40, 0, _T("宋体"));
-        outtextxy(x, y, (TCHAR*)text);
-        FlushBatchDraw();
-        Sleep(200);
-        setfillcolor(WHITE);
-        solidrectangle(x, y, x + 400, y + 50);
-    }
+    return hash ^ zobristKeys[move & 0xFF][player] ^ zobristKeys[(move >> 8) & 0xFF][player] ^
+        zobristKeys[(move >> 16) & 0xFF][ARROW] ^ zobristBlackToMove;
 }
 
-//人类操作
-Position getClickPosition()
+//只读内存映射文件
+struct MappedFile
 {
-    MOUSEMSG m;
-    while (true)
+    HANDLE file;
+    HANDLE mapping;
+    const uint8_t* data;
+    size_t size;
+};
+
+bool mapFile(MappedFile& mapped, const string& path)
+{
+    mapped = { INVALID_HANDLE_VALUE, NULL, nullptr, 0 };
+    mapped.file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (mapped.file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(mapped.file, &size) || size.QuadPart == 0)
     {
-        m = GetMouseMsg();
-        if (m.uMsg == WM_LBUTTONDOWN)
-        {
-            int click_x = m.x, click_y = m.y;
-            if (click_x >= BOARD_PADDING && click_x < WINDOW_SIZE - BOARD_PADDING &&
-                click_y >= BOARD_PADDING && click_y < WINDOW_SIZE - BOARD_PADDING)
-            {
-                int c = (click_x - BOARD_PADDING) / CELL_SIZE;
-                int r = (click_y - BOARD_PADDING) / CELL_SIZE;
-                if (r >= 0 && r < BOARD_SIZE && c >= 0 && c < BOARD_SIZE)
-                    return { r, c };
-            }
-            return { -1, -1 };
-        }
+        CloseHandle(mapped.file);
+        mapped.file = INVALID_HANDLE_VALUE;
+        return false;
+    }
+    mapped.size = (size_t)size.QuadPart;
+    mapped.mapping = CreateFileMappingA(mapped.file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapped.mapping != NULL)
+        mapped.data = (const uint8_t*)MapViewOfFile(mapped.mapping, FILE_MAP_READ, 0, 0, 0);
+    if (mapped.data == nullptr)
+    {
+        if (mapped.mapping != NULL)
+            CloseHandle(mapped.mapping);
+        CloseHandle(mapped.file);
+        mapped = { INVALID_HANDLE_VALUE, NULL, nullptr, 0 };
+        return false;
     }
+    return true;
 }
 
-int getButtonClick(const MOUSEMSG& m)
+void unmapFile(MappedFile& mapped)
 {
-    for (size_t i = 0; i < buttons.size(); ++i)
-    {
-        const auto& btn = buttons[i];
-        if (m.x >= btn.x && m.x <= btn.x + btn.w &&
-            m.y >= btn.y && m.y <= btn.y + btn.h)
-            return (int)i;
+    if (mapped.data != nullptr)
+        UnmapViewOfFile(mapped.data);
+    if (mapped.mapping != NULL)
+        CloseHandle(mapped.mapping);
+    if (mapped.file != INVALID_HANDLE_VALUE)
+        CloseHandle(mapped.file);
+    mapped = { INVALID_HANDLE_VALUE, NULL, nullptr, 0 };
+}
+
+//棋谱库：只读映射，按对局表 + 追加式着法流 + 局面哈希索引组织，各段 8 字节对齐
+//  DbHeader
+//  DbGameEntry × 对局数
+//  PackedMove  × 着法总数（每局的着法连续存放，新对局只追加在末尾）
+//  DbIndexEntry × 局面数（按 哈希、对局、步数 排序，每局的每个局面各一项）
+#pragma pack(push, 1)
+struct DbHeader
+{
+    char magic[4];
+    uint16_t version;
+    uint8_t board_size;
+    uint8_t reserved0;
+    uint32_t game_count;
+    uint32_t reserved1;
+    uint64_t move_count;
+    uint64_t index_count;
+    uint64_t games_offset;
+    uint64_t moves_offset;
+    uint64_t index_offset;
+    uint64_t reserved2;
+};
+
+struct DbGameEntry
+{
+    uint64_t first_move;
+    uint32_t ply_count;
+    uint8_t start_player;
+    uint8_t winner;     //EMPTY 表示未分胜负
+    uint16_t reserved;
+};
+
+struct DbIndexEntry
+{
+    uint64_t hash;
+    uint32_t game;
+    uint32_t ply;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(DbHeader) == 64 && sizeof(DbGameEntry) == 16 && sizeof(DbIndexEntry) == 16,
+    "棋谱库记录布局不能改变");
+
+const char DB_MAGIC[4] = { 'A', 'M', 'D', 'B' };
+const uint16_t DB_VERSION = 1;
+const PackedMove NO_PACKED_MOVE = 0xFFFFFFFF;
+
+struct GameDatabase
+{
+    MappedFile file;
+    const DbHeader* header;
+    const DbGameEntry* games;
+    const PackedMove* moves;
+    const DbIndexEntry* index;
+};
+
+bool dbIndexLess(const DbIndexEntry& a, const DbIndexEntry& b)
+{
+    if (a.hash != b.hash)
+        return a.hash < b.hash;
+    if (a.game != b.game)
+        return a.game < b.game;
+    return a.ply < b.ply;
+}
+
+void closeGameDatabase(GameDatabase& db)
+{
+    unmapFile(db.file);
+    db.header = nullptr;
+    db.games = nullptr;
+    db.moves = nullptr;
+    db.index = nullptr;
+}
+
+bool openGameDatabase(GameDatabase& db, const string& path)
+{
+    db.header = nullptr;
+    if (!mapFile(db.file, path))
+        return false;
+
+    const uint8_t* base = db.file.data;
+    size_t size = db.file.size;
+    const DbHeader* header = (const DbHeader*)base;
+    auto fits = [size](uint64_t offset, uint64_t count, uint64_t item)
+        {
+            return offset <= size && count <= (size - offset) / item;
+        };
+    if (size < sizeof(DbHeader) || !equal(DB_MAGIC, DB_MAGIC + 4, header->magic) ||
+        header->version != DB_VERSION || header->board_size != boardSize ||
+        !fits(header->games_offset, header->game_count, sizeof(DbGameEntry)) ||
+        !fits(header->moves_offset, header->move_count, sizeof(PackedMove)) ||
+        !fits(header->index_offset, header->index_count, sizeof(DbIndexEntry)))
+    {
+        cerr << "错误：棋谱库文件 " << path << " 格式不正确。" << endl;
+        closeGameDatabase(db);
+        return false;
     }
-    return -1;
+
+    db.header = header;
+    db.games = (const DbGameEntry*)(base + header->games_offset);
+    db.moves = (const PackedMove*)(base + header->moves_offset);
+    db.index = (const DbIndexEntry*)(base + header->index_offset);
+
+    //复现和查询时格子编号、行棋方直接做棋盘和 Zobrist 表的下标，打开时整库检查一遍
+    const char* problem = nullptr;
+    for (uint32_t g = 0; g < header->game_count && !problem; ++g)
+    {
+        const DbGameEntry& entry = db.games[g];
+        if (entry.first_move > header->move_count || entry.ply_count > header->move_count - entry.first_move)
+            problem = "对局表越界";
+        else if ((entry.start_player != WHITE_QUEEN && entry.start_player != BLACK_QUEEN) ||
+            (entry.winner != EMPTY && entry.winner != WHITE_QUEEN && entry.winner != BLACK_QUEEN))
+            problem = "对局表的行棋方或胜方无效";
+    }
+    uint32_t cells = (uint32_t)(boardSize * boardSize);
+    for (uint64_t i = 0; i < header->move_count && !problem; ++i)
+    {
+        PackedMove move = db.moves[i];
+        if ((move & 0xFF) >= cells || ((move >> 8) & 0xFF) >= cells || ((move >> 16) & 0xFF) >= cells || (move >> 24) != 0)
+            problem = "着法流中有越界的格子";
+    }
+    for (uint64_t i = 0; i < header->index_count && !problem; ++i)
+    {
+        const DbIndexEntry& entry = db.index[i];
+        if (entry.game >= header->game_count || entry.ply > db.games[entry.game].ply_count)
+            problem = "索引指向不存在的局面";
+    }
+    if (problem)
+    {
+        cerr << "错误：棋谱库文件 " << path << " " << problem << "。" << endl;
+        closeGameDatabase(db);
+        return false;
+    }
+    return true;
 }
 
+//在映射的索引上二分查找，返回同一局面的所有出现位置
+pair<const DbIndexEntry*, const DbIndexEntry*> findPosition(const GameDatabase& db, uint64_t hash)
+{
+    const DbIndexEntry* first = db.index;
+    const DbIndexEntry* last = db.index + db.header->index_count;
+    first = lower_bound(first, last, hash, [](const DbIndexEntry& e, uint64_t h) { return e.hash < h; });
+    last = upper_bound(first, last, hash, [](uint64_t h, const DbIndexEntry& e) { return h < e.hash; });
+    return { first, last };
+}
 
-Move getPlayerMoveByClick(const Board& board, Piece current_player)
+PackedMove dbMoveAt(const GameDatabase& db, uint32_t game, uint32_t ply)
 {
-    Move move;
-    Position p = { -1, -1 };
-    int step = 1;
-    vector<Move> all_possible_moves;
+    const DbGameEntry& entry = db.games[game];
+    return ply < entry.ply_count ? db.moves[entry.first_move + ply] : NO_PACKED_MOVE;
+}
 
-    BeginBatchDraw();
+struct ScannedPosition
+{
+    const Board* board;     //扫描线程复用的棋盘，只在回调期间有效
+    uint64_t hash;
+    Piece side_to_move;
+    uint32_t game;
+    uint32_t ply;
+    PackedMove next_move;   //终局局面为 NO_PACKED_MOVE
+    uint8_t winner;
+    int worker;             //扫描线程编号，便于回调按线程分桶统计而不加锁
+};
+
+typedef function<void(const ScannedPosition&)> PositionVisitor;
+
+//直接从映射的着法流复现 [first_game, last_game) 的每个局面，整段只用一块棋盘
+void scanGameDatabase(const GameDatabase& db, uint32_t first_game, uint32_t last_game,
+    const PositionVisitor& visit, int worker = 0)
+{
+    const Board start = initializeBoard();
+    Board board = start;
+    ScannedPosition pos;
+    pos.board = &board;
+    pos.worker = worker;
+    for (uint32_t g = first_game; g < last_game; ++g)
+    {
+        const DbGameEntry& entry = db.games[g];
+        const PackedMove* moves = db.moves + entry.first_move;
+        board = start;
+        pos.game = g;
+        pos.winner = entry.winner;
+        pos.side_to_move = (Piece)entry.start_player;
+        pos.hash = hashBoard(board, pos.side_to_move);
+        for (uint32_t ply = 0; ; ++ply)
+        {
+            pos.ply = ply;
+            pos.next_move = ply < entry.ply_count ? moves[ply] : NO_PACKED_MOVE;
+            visit(pos);
+            if (ply == entry.ply_count)
+                break;
+            makeMove(board, unpackMove(moves[ply]), pos.side_to_move, false);
+            pos.hash = hashAfterMove(pos.hash, moves[ply], pos.side_to_move);
+            pos.side_to_move = opponentOf(pos.side_to_move);
+        }
+    }
+}
+
+//按着法数把对局切成互不相交的区间，每个线程扫描一段
+void parallelScanGameDatabase(const GameDatabase& db, int threads, const PositionVisitor& visit)
+{
+    uint32_t game_count = db.header->game_count;
+    threads = max(1, min(threads, (int)max(1u, game_count)));
+    vector<uint32_t> bounds(threads + 1, game_count);
+    bounds[0] = 0;
+    for (int t = 1; t < threads; ++t)
+    {
+        uint64_t target = db.header->move_count * t / threads;
+        bounds[t] = (uint32_t)(partition_point(db.games, db.games + game_count,
+            [target](const DbGameEntry& e) { return e.first_move < target; }) - db.games);
+    }
+
+    vector<thread> workers;
+    for (int t = 0; t < threads; ++t)
+        workers.emplace_back([&db, &visit, &bounds, t]()
+            {
+                scanGameDatabase(db, bounds[t], bounds[t + 1], visit, t);
+            });
+    for (auto& w : workers)
+        w.join();
+}
+
+void putU64(vector<uint8_t>& out, uint64_t v)
+{
+    putU32(out, (uint32_t)v);
+    putU32(out, (uint32_t)(v >> 32));
+}
+
+//把新对局追加到棋谱库末尾：已有对局、着法和索引原样保留，新局面的索引项排序后归并
+//已有的文件打不开或不合格（棋盘大小不同、损坏、版本不对）时不动它；新库先写进临时文件再换名替换，
+//写到一半出错也不会损坏原来的库
+bool appendGamesToDatabase(const string& path, const vector<GameRecord>& records)
+{
+    vector<DbGameEntry> games;
+    vector<PackedMove> moves;
+    vector<DbIndexEntry> index;
+
+    GameDatabase existing;
+    if (ifstream(path, ios::binary).is_open())
+    {
+        if (!openGameDatabase(existing, path))
+        {
+            cerr << "错误：已有的棋谱库 " << path << " 无法读取，没有改动它。" << endl;
+            return false;
+        }
+        games.assign(existing.games, existing.games + existing.header->game_count);
+        moves.assign(existing.moves, existing.moves + existing.header->move_count);
+        index.assign(existing.index, existing.index + existing.header->index_count);
+        closeGameDatabase(existing);
+    }
+
+    const Board start = initializeBoard();
+    vector<DbIndexEntry> added;
+    for (const auto& record : records)
+    {
+        if (record.start_board != start)
+        {
+            cerr << "警告：跳过一局非标准开局的棋谱。" << endl;
+            continue;
+        }
+        uint32_t game = (uint32_t)games.size();
+        DbGameEntry entry = { moves.size(), (uint32_t)record.moves.size(),
+            (uint8_t)record.start_player, EMPTY, 0 };
+
+        Board board = start;
+        Piece player = record.start_player;
+        uint64_t hash = hashBoard(board, player);
+        for (uint32_t ply = 0; ply <= record.moves.size(); ++ply)
+        {
+            added.push_back({ hash, game, ply });
+            if (ply == record.moves.size())
+                break;
+            makeMove(board, unpackMove(record.moves[ply]), player, false);
+            hash = hashAfterMove(hash, record.moves[ply], player);
+            player = opponentOf(player);
+        }
+        if (checkGameOver(board, player))
+            entry.winner = (uint8_t)opponentOf(player);
+
+        moves.insert(moves.end(), record.moves.begin(), record.moves.end());
+        games.push_back(entry);
+    }
+
+    sort(added.begin(), added.end(), dbIndexLess);
+    vector<DbIndexEntry> merged(index.size() + added.size());
+    merge(index.begin(), index.end(), added.begin(), added.end(), merged.begin(), dbIndexLess);
+
+    vector<uint8_t> header(DB_MAGIC, DB_MAGIC + 4);
+    uint64_t games_offset = sizeof(DbHeader);
+    uint64_t moves_offset = games_offset + games.size() * sizeof(DbGameEntry);
+    uint64_t index_offset = (moves_offset + moves.size() * sizeof(PackedMove) + 7) & ~7ull;
+    putU16(header, DB_VERSION);
+    header.push_back((uint8_t)boardSize);
+    header.push_back(0);
+    putU32(header, (uint32_t)games.size());
+    putU32(header, 0);
+    putU64(header, moves.size());
+    putU64(header, merged.size());
+    putU64(header, games_offset);
+    putU64(header, moves_offset);
+    putU64(header, index_offset);
+    putU64(header, 0);
+
+    string temp_path = path + ".tmp";
+    ofstream out(temp_path, ios::binary | ios::trunc);
+    if (!out.is_open())
+    {
+        cerr << "错误：无法写入棋谱库 " << temp_path << endl;
+        return false;
+    }
+    out.write((const char*)header.data(), header.size());
+    out.write((const char*)games.data(), games.size() * sizeof(DbGameEntry));
+    out.write((const char*)moves.data(), moves.size() * sizeof(PackedMove));
+    static const char padding[8] = {};
+    out.write(padding, index_offset - (moves_offset + moves.size() * sizeof(PackedMove)));
+    out.write((const char*)merged.data(), merged.size() * sizeof(DbIndexEntry));
+    out.close();
+    if (!out.good() || !MoveFileExA(temp_path.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    {
+        cerr << "错误：写入棋谱库 " << path << " 失败，原文件未改动。" << endl;
+        DeleteFileA(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+//开局库：按局面哈希排序的 (哈希, 着法, 权重) 表，运行时只读映射
+//  BookHeader
+//  BookEntry × 条目数（按 哈希、着法 排序）
+#pragma pack(push, 1)
+struct BookHeader
+{
+    char magic[4];
+    uint16_t version;
+    uint8_t board_size;
+    uint8_t reserved0;
+    uint32_t entry_count;
+    uint32_t reserved1;
+};
+
+struct BookEntry
+{
+    uint64_t hash;
+    PackedMove move;
+    uint16_t weight;
+    uint16_t reserved;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(BookHeader) == 16 && sizeof(BookEntry) == 16, "开局库记录布局不能改变");
+
+const char BOOK_MAGIC[4] = { 'A', 'M', 'O', 'B' };
+const uint16_t BOOK_VERSION = 1;
+
+struct OpeningBook
+{
+    MappedFile file;
+    const BookEntry* entries;
+    uint32_t count;
+};
+
+//每种棋盘大小各有一个开局库，启动时全部映射，对局中途改变大小也不必重新打开
+OpeningBook openingBooks[MAX_BOARD_SIZE + 1];
+
+string bookFileName(int size)
+{
+    return size == DEFAULT_BOARD_SIZE ? BOOK_FILE_NAME : "amazons_book_" + to_string(size) + ".bin";
+}
+
+bool openOpeningBook(OpeningBook& book, const string& path, int size = boardSize)
+{
+    book.entries = nullptr;
+    book.count = 0;
+    if (!mapFile(book.file, path))
+        return false;
+    const BookHeader* header = (const BookHeader*)book.file.data;
+    if (book.file.size < sizeof(BookHeader) || !equal(BOOK_MAGIC, BOOK_MAGIC + 4, header->magic) ||
+        header->version != BOOK_VERSION || header->board_size != size ||
+        header->entry_count > (book.file.size - sizeof(BookHeader)) / sizeof(BookEntry))
+    {
+        cerr << "错误：开局库文件 " << path << " 格式不正确。" << endl;
+        unmapFile(book.file);
+        return false;
+    }
+    book.entries = (const BookEntry*)(book.file.data + sizeof(BookHeader));
+    book.count = header->entry_count;
+    return true;
+}
+
+void closeOpeningBook(OpeningBook& book)
+{
+    if (book.entries == nullptr)
+        return;
+    unmapFile(book.file);
+    book.entries = nullptr;
+    book.count = 0;
+}
+
+//按权重随机选一个库内着法；会再次校验合法性，防止哈希碰撞
+bool probeOpeningBook(const Board& board, Piece player, Move& move)
+{
+    int size = (int)board.size();
+    const OpeningBook& book = openingBooks[size];
+    if (book.count == 0)
+        return false;
+    uint64_t hash = hashBoard(board, player);
+    const BookEntry* first = lower_bound(book.entries, book.entries + book.count, hash,
+        [](const BookEntry& e, uint64_t h) { return e.hash < h; });
+    uint32_t total = 0;
+    const BookEntry* last = first;
+    for (; last != book.entries + book.count && last->hash == hash; ++last)
+        if (isMoveValid(unpackMove(last->move, size), board, player))
+            total += last->weight;
+    if (total == 0)
+        return false;
+
+    static thread_local mt19937 rng(random_device{}());
+    uint32_t pick = uniform_int_distribution<uint32_t>(0, total - 1)(rng);
+    for (const BookEntry* e = first; e != last; ++e)
+    {
+        Move candidate = unpackMove(e->move, size);
+        if (!isMoveValid(candidate, board, player))
+            continue;
+        if (pick < e->weight)
+        {
+            move = candidate;
+            return true;
+        }
+        pick -= e->weight;
+    }
+    return false;
+}
+
+bool writeOpeningBook(const string& path, const map<pair<uint64_t, PackedMove>, uint32_t>& weights)
+{
+    vector<uint8_t> out(BOOK_MAGIC, BOOK_MAGIC + 4);
+    putU16(out, BOOK_VERSION);
+    out.push_back((uint8_t)boardSize);
+    out.push_back(0);
+    putU32(out, (uint32_t)weights.size());
+    putU32(out, 0);
+    //map 的顺序即 (哈希, 着法) 升序
+    for (const auto& kv : weights)
+    {
+        putU32(out, (uint32_t)kv.first.first);
+        putU32(out, (uint32_t)(kv.first.first >> 32));
+        putU32(out, kv.first.second);
+        putU16(out, (uint16_t)min<uint32_t>(max<uint32_t>(kv.second, 1), 0xFFFF));
+        putU16(out, 0);
+    }
+    ofstream file(path, ios::binary | ios::trunc);
+    if (!file.is_open())
+    {
+        cerr << "错误：无法写入开局库 " << path << endl;
+        return false;
+    }
+    file.write((const char*)out.data(), out.size());
+    return file.good();
+}
 
-    while (step <= 3)
+//图形界面
+struct Highlight
+{
+    Position pos;
+    COLORREF color;
+};
+
+struct CellView
+{
+    int piece;
+    bool highlighted;
+    COLORREF color;
+    bool operator==(const CellView& other) const
+    {
+        return piece == other.piece && highlighted == other.highlighted &&
+            (!highlighted || color == other.color);
+    }
+};
+
+//渲染缓存：静态棋盘底图 + 按格色预合成的棋子贴图，只重绘发生变化的格子
+IMAGE boardBackground;
+IMAGE cellSprites[4][2];
+vector<vector<CellView>> shownCells;
+bool renderCacheReady = false;
+bool boardViewValid = false;
+
+void drawButtons()
+{
+    settextstyle(20, 0, _T("宋体"));
+    for (const auto& btn : buttons)
     {
-        printBoardGraphics(board);
+        setlinecolor(BLACK);
+        setfillcolor(RGB(220, 220, 220));
+        fillrectangle(btn.x, btn.y, btn.x + btn.w, btn.y + btn.h);
         settextcolor(BLACK);
+        outtextxy(btn.x + 15, btn.y + 10, (TCHAR*)btn.text);
+    }
+}
+
+void drawPiece(int center_x, int center_y, int piece)
+{
+    int radius = CELL_SIZE / 3;
+    setlinecolor(DARKGRAY);
+    setlinestyle(PS_SOLID, 2);
+    switch (piece)
+    {
+    case BLACK_QUEEN:
+        setfillcolor(RGB(220, 220, 220));
+        fillcircle(center_x, center_y, radius);
+        setfillcolor(RGB(255, 255, 255));
+        solidcircle(center_x - radius / 3, center_y - radius / 3, radius / 2);
+        break;
+    case WHITE_QUEEN:
+        setfillcolor(RGB(40, 40, 40));
+        fillcircle(center_x, center_y, radius);
+        setfillcolor(RGB(180, 180, 180));
+        solidcircle(center_x - radius / 3, center_y - radius / 3, radius / 2);
+        break;
+    case ARROW:
+        setfillcolor(RGB(100, 100, 100));
+        fillcircle(center_x, center_y, radius);
+        setfillcolor(RGB(180, 180, 180));
+        solidcircle(center_x - radius / 3, center_y - radius / 3, radius / 2);
+        break;
+    }
+}
+
+void initRenderCache()
+{
+    boardBackground.Resize(windowSize, windowSize);
+    SetWorkingImage(&boardBackground);
+    setbkcolor(WHITE);
+    cleardevice();
+
+    for (int r = 0; r < boardSize; r++)
+    {
+        for (int c = 0; c < boardSize; c++)
+        {
+            int left = BOARD_PADDING + c * CELL_SIZE;
+            int top = BOARD_PADDING + r * CELL_SIZE;
+            COLORREF cellColor = ((r + c) % 2 == 0) ? RGB(240, 217, 181) : RGB(181, 136, 99);
+            setfillcolor(cellColor);
+            solidrectangle(left, top, left + CELL_SIZE, top + CELL_SIZE);
+        }
+    }
+
+    setlinecolor(DARKGRAY);
+    setlinestyle(PS_SOLID, 2);
+    for (int i = 0; i <= boardSize; ++i)
+    {
+        int pos = BOARD_PADDING + i * CELL_SIZE;
+        line(BOARD_PADDING, pos, windowSize - BOARD_PADDING, pos);
+        line(pos, BOARD_PADDING, pos, windowSize - BOARD_PADDING);
+    }
 
-        if (step == 2)
+    //每个格子（连同网格线）在同色格之间像素一致，取 (1,1)/(1,2) 作为两种底色的模板
+    for (int piece = EMPTY; piece <= ARROW; ++piece)
+    {
+        for (int parity = 0; parity < 2; ++parity)
         {
-            settextstyle(20, 0, _T("宋体"));
-            outtextxy(10, WINDOW_SIZE - 25, _T("2/3: 请点击皇后目标"));
-            for (const auto& m : all_possible_moves)
-                drawHighlight(m.queen_end, RGB(196, 168, 143));
+            cellSprites[piece][parity].Resize(CELL_SIZE, CELL_SIZE);
+            SetWorkingImage(&cellSprites[piece][parity]);
+            putimage(0, 0, CELL_SIZE, CELL_SIZE, &boardBackground,
+                BOARD_PADDING + (1 + parity) * CELL_SIZE, BOARD_PADDING + CELL_SIZE);
+            drawPiece(CELL_SIZE / 2, CELL_SIZE / 2, piece);
         }
-        else if (step == 3)
+    }
+
+    SetWorkingImage();
+    renderCacheReady = true;
+    boardViewValid = false;
+}
+
+//按当前棋盘大小创建窗口；读入不同大小的存档时重建窗口
+int windowBoardSize = 0;
+
+void openGameWindow()
+{
+    if (windowBoardSize != 0)
+    {
+        EndBatchDraw();
+        closegraph();
+    }
+    initgraph(windowSize + BUTTON_WIDTH + 60, windowSize, EW_SHOWCONSOLE);
+    setbkcolor(WHITE);
+    cleardevice();
+    BeginBatchDraw();
+    windowBoardSize = boardSize;
+    renderCacheReady = false;
+    boardViewValid = false;
+}
+
+void invalidateBoardView()
+{
+    boardViewValid = false;
+}
+
+void drawCell(int r, int c, const CellView& view)
+{
+    int left = BOARD_PADDING + c * CELL_SIZE;
+    int top = BOARD_PADDING + r * CELL_SIZE;
+    putimage(left, top, &cellSprites[view.piece][(r + c) % 2]);
+    if (view.highlighted)
+    {
+        setfillcolor(view.color);
+        solidrectangle(left + 1, top + 1, left + CELL_SIZE - 4, top + CELL_SIZE - 4);
+    }
+    shownCells[r][c] = view;
+    markDirty(left, top, left + CELL_SIZE, top + CELL_SIZE);
+}
+
+void redrawCellsInRect(int left, int top, int right, int bottom)
+{
+    int c0 = max(0, (left - BOARD_PADDING) / CELL_SIZE);
+    int r0 = max(0, (top - BOARD_PADDING) / CELL_SIZE);
+    int c1 = min(boardSize - 1, (right - BOARD_PADDING) / CELL_SIZE);
+    int r1 = min(boardSize - 1, (bottom - BOARD_PADDING) / CELL_SIZE);
+    for (int r = r0; r <= r1; ++r)
+        for (int c = c0; c <= c1; ++c)
+            drawCell(r, c, shownCells[r][c]);
+}
+
+//返回是否有格子被重绘
+bool renderBoard(const Board& board, const vector<Highlight>& highlights = {})
+{
+    if (!renderCacheReady)
+        initRenderCache();
+
+    bool changed = false;
+    if (!boardViewValid)
+    {
+        cleardevice();
+        putimage(0, 0, &boardBackground);
+        shownCells.assign(boardSize, vector<CellView>(boardSize, { EMPTY, false, 0 }));
+        drawButtons();
+        paintStatusStrip();
+        boardViewValid = true;
+        markDirty(0, 0, windowSize + BUTTON_WIDTH + 60, windowSize);
+        changed = true;
+    }
+
+    vector<vector<CellView>> target(boardSize, vector<CellView>(boardSize));
+    for (int r = 0; r < boardSize; r++)
+        for (int c = 0; c < boardSize; c++)
+            target[r][c] = { board[r][c], false, 0 };
+    for (const auto& h : highlights)
+        target[h.pos.row][h.pos.col] = { target[h.pos.row][h.pos.col].piece, true, h.color };
+
+    for (int r = 0; r < boardSize; r++)
+    {
+        for (int c = 0; c < boardSize; c++)
         {
-            settextstyle(20, 0, _T("宋体"));
-            outtextxy(10, WINDOW_SIZE - 25, _T("3/3: 请点击射箭目标"));
-            for (const auto& m : all_possible_moves)
-                if (m.queen_end == move.queen_end)
-                    drawHighlight(m.arrow_pos, RGB(138, 51, 36));
+            if (!(target[r][c] == shownCells[r][c]))
+            {
+                drawCell(r, c, target[r][c]);
+                changed = true;
+            }
         }
+    }
+    return changed;
+}
+
+void drawSideText(int row, const TCHAR* text)
+{
+    int top = BUTTON_AREA_Y + row * (BUTTON_HEIGHT + BUTTON_GAP);
+    setfillcolor(WHITE);
+    solidrectangle(buttonAreaX, top, buttonAreaX + BUTTON_WIDTH + 40, top + BUTTON_HEIGHT);
+    settextcolor(BLACK);
+    settextstyle(20, 0, _T("宋体"));
+    outtextxy(buttonAreaX, top, (TCHAR*)text);
+    markDirty(buttonAreaX, top, buttonAreaX + BUTTON_WIDTH + 40, top + BUTTON_HEIGHT);
+}
+
+void animateMove(const Position& start, const Position& end, Piece piece, function<void()> onDone)
+{
+    int sx = BOARD_PADDING + start.col * CELL_SIZE + CELL_SIZE / 2;
+    int sy = BOARD_PADDING + start.row * CELL_SIZE + CELL_SIZE / 2;
+    int ex = BOARD_PADDING + end.col * CELL_SIZE + CELL_SIZE / 2;
+    int ey = BOARD_PADDING + end.row * CELL_SIZE + CELL_SIZE / 2;
+    int radius = CELL_SIZE / 3 + 1;
+    auto last = make_shared<pair<int, int>>(sx, sy);
+
+    scheduleTask(200, [=](double t)
+        {
+            int x = sx + (int)((ex - sx) * t);
+            int y = sy + (int)((ey - sy) * t);
+
+            //只擦除上一帧棋子覆盖的格子
+            redrawCellsInRect(last->first - radius, last->second - radius,
+                last->first + radius, last->second + radius);
+            drawPiece(x, y, piece);
+            markDirty(x - radius, y - radius, x + radius, y + radius);
+            *last = { x, y };
+        },
+        [=]()
+        {
+            redrawCellsInRect(last->first - radius, last->second - radius,
+                last->first + radius, last->second + radius);
+            if (onDone)
+                onDone();
+        });
+}
+
+//特效
+void showFireworks()
+{
+    int cx = windowSize / 2, cy = windowSize / 2;
+    auto drawn = make_shared<int>(0);
+    scheduleTask(900, [=](double t)
+        {
+            for (; *drawn < (int)(t * 30); ++*drawn)
+            {
+                for (int i = 0; i < 40; ++i)
+                {
+                    double angle = rand() * 2 * 3.14159 / RAND_MAX;
+                    int r = 30 + *drawn * 4;
+                    int x = cx + (int)(r * cos(angle));
+                    int y = cy + (int)(r * sin(angle));
+                    setfillcolor(RGB(rand() % 256, rand() % 256, rand() % 256));
+                    solidcircle(x, y, 4);
+                }
+            }
+            markDirty(0, 0, windowSize, windowSize);
+        });
+}
+
+void showBlinkText(const wchar_t* text, int x, int y)
+{
+    wstring shown = text;
+    auto phase = make_shared<int>(-1);
+    scheduleTask(1600, [=](double t)
+        {
+            int i = min(7, (int)(t * 8));
+            if (i == *phase)
+                return;
+            *phase = i;
+            setfillcolor(WHITE);
+            solidrectangle(x, y, x + 400, y + 50);
+            settextcolor(i % 2 == 0 ? RED : RGB(255, 215, 0));
+            settextstyle(40, 0, _T("宋体"));
+            outtextxy(x, y, (TCHAR*)shown.c_str());
+            markDirty(x, y, x + 400, y + 50);
+        },
+        [=]()
+        {
+            setfillcolor(WHITE);
+            solidrectangle(x, y, x + 400, y + 50);
+            markDirty(x, y, x + 400, y + 50);
+        });
+}
+
+//人类操作
+Position screenToCell(int x, int y)
+{
+    if (x >= BOARD_PADDING && x < windowSize - BOARD_PADDING &&
+        y >= BOARD_PADDING && y < windowSize - BOARD_PADDING)
+    {
+        int c = (x - BOARD_PADDING) / CELL_SIZE;
+        int r = (y - BOARD_PADDING) / CELL_SIZE;
+        if (r >= 0 && r < boardSize && c >= 0 && c < boardSize)
+            return { r, c };
+    }
+    return { -1, -1 };
+}
+
+int getButtonClick(const MOUSEMSG& m)
+{
+    for (size_t i = 0; i < buttons.size(); ++i)
+    {
+        const auto& btn = buttons[i];
+        if (m.x >= btn.x && m.x <= btn.x + btn.w &&
+            m.y >= btn.y && m.y <= btn.y + btn.h)
+            return (int)i;
+    }
+    return -1;
+}
+
+
+//AI逻辑
+//引擎：规则、着法生成、评估与搜索都按棋盘大小实例化
+//8x8 的位棋盘是一个 uint64_t，10x10 需要 100 位，用两个字拼成 Bits128
+struct Bits128
+{
+    uint64_t lo, hi;
+};
+
+inline Bits128 operator&(Bits128 a, Bits128 b) { return { a.lo & b.lo, a.hi & b.hi }; }
+inline Bits128 operator|(Bits128 a, Bits128 b) { return { a.lo | b.lo, a.hi | b.hi }; }
+inline Bits128 operator^(Bits128 a, Bits128 b) { return { a.lo ^ b.lo, a.hi ^ b.hi }; }
+inline Bits128 operator~(Bits128 a) { return { ~a.lo, ~a.hi }; }
+inline Bits128& operator&=(Bits128& a, Bits128 b) { a.lo &= b.lo; a.hi &= b.hi; return a; }
+inline Bits128& operator|=(Bits128& a, Bits128 b) { a.lo |= b.lo; a.hi |= b.hi; return a; }
+inline Bits128& operator^=(Bits128& a, Bits128 b) { a.lo ^= b.lo; a.hi ^= b.hi; return a; }
+
+inline int popCount(uint64_t b) { return popcount(b); }
+inline int popCount(Bits128 b) { return popcount(b.lo) + popcount(b.hi); }
+inline bool isEmpty(uint64_t b) { return b == 0; }
+inline bool isEmpty(Bits128 b) { return (b.lo | b.hi) == 0; }
+inline bool testBit(uint64_t b, int sq) { return (b >> sq) & 1; }
+inline bool testBit(Bits128 b, int sq) { return sq < 64 ? (b.lo >> sq) & 1 : (b.hi >> (sq - 64)) & 1; }
+
+inline int popLsb(uint64_t& b)
+{
+    int sq = countr_zero(b);
+    b &= b - 1;
+    return sq;
+}
+
+inline int popLsb(Bits128& b)
+{
+    if (b.lo)
+        return popLsb(b.lo);
+    return 64 + popLsb(b.hi);
+}
+
+template <int N>
+using Bitboard = conditional_t<N * N <= 64, uint64_t, Bits128>;
+
+template <class B>
+B squareBit(int sq);
+
+template <>
+inline uint64_t squareBit<uint64_t>(int sq) { return 1ull << sq; }
+
+template <>
+inline Bits128 squareBit<Bits128>(int sq)
+{
+    return sq < 64 ? Bits128{ 1ull << sq, 0 } : Bits128{ 0, 1ull << (sq - 64) };
+}
+
+const int DIRECTIONS[8][2] = { {0, 1}, {0, -1}, {1, 0}, {-1, 0}, {1, 1}, {-1, -1}, {1, -1}, {-1, 1} };
+
+//每个格子的相邻格掩码与八个方向上的射线
+template <int N>
+struct EngineTables
+{
+    Bitboard<N> neighbors[N * N];
+    int8_t rays[N * N][8][N];
+    int8_t rayLength[N * N][8];
+
+    EngineTables()
+    {
+        for (int sq = 0; sq < N * N; ++sq)
+        {
+            int r = sq / N, c = sq % N;
+            neighbors[sq] = Bitboard<N>{};
+            for (int d = 0; d < 8; ++d)
+            {
+                int len = 0;
+                for (int nr = r + DIRECTIONS[d][0], nc = c + DIRECTIONS[d][1];
+                    isInside(nr, nc, N); nr += DIRECTIONS[d][0], nc += DIRECTIONS[d][1])
+                    rays[sq][d][len++] = (int8_t)(nr * N + nc);
+                rayLength[sq][d] = (int8_t)len;
+                if (len > 0)
+                    neighbors[sq] |= squareBit<Bitboard<N>>(rays[sq][d][0]);
+            }
+        }
+    }
+};
+
+template <int N>
+const EngineTables<N>& engineTables()
+{
+    static const EngineTables<N> tables;
+    return tables;
+}
+
+template <int N>
+struct EnginePosition
+{
+    Bitboard<N> queens[2];   //[0] 白方 [1] 黑方
+    Bitboard<N> arrows;
+};
+
+inline int sideIndex(Piece player)
+{
+    return player == BLACK_QUEEN ? 1 : 0;
+}
+
+inline int moveFrom(PackedMove move) { return move & 0xFF; }
+inline int moveTo(PackedMove move) { return (move >> 8) & 0xFF; }
+inline int moveArrow(PackedMove move) { return (move >> 16) & 0xFF; }
+
+template <int N>
+Bitboard<N> occupiedOf(const EnginePosition<N>& pos)
+{
+    return pos.queens[0] | pos.queens[1] | pos.arrows;
+}
+
+template <int N>
+EnginePosition<N> positionFromBoard(const Board& board)
+{
+    EnginePosition<N> pos = { { Bitboard<N>{}, Bitboard<N>{} }, Bitboard<N>{} };
+    for (int r = 0; r < N; ++r)
+        for (int c = 0; c < N; ++c)
+        {
+            Bitboard<N> bit = squareBit<Bitboard<N>>(r * N + c);
+            if (board[r][c] == WHITE_QUEEN)
+                pos.queens[0] |= bit;
+            else if (board[r][c] == BLACK_QUEEN)
+                pos.queens[1] |= bit;
+            else if (board[r][c] == ARROW)
+                pos.arrows |= bit;
+        }
+    return pos;
+}
+
+template <int N>
+void makeMove(EnginePosition<N>& pos, PackedMove move, int side)
+{
+    pos.queens[side] ^= squareBit<Bitboard<N>>(moveFrom(move)) | squareBit<Bitboard<N>>(moveTo(move));
+    pos.arrows |= squareBit<Bitboard<N>>(moveArrow(move));
+}
+
+template <int N>
+void undoMove(EnginePosition<N>& pos, PackedMove move, int side)
+{
+    pos.arrows ^= squareBit<Bitboard<N>>(moveArrow(move));
+    pos.queens[side] ^= squareBit<Bitboard<N>>(moveFrom(move)) | squareBit<Bitboard<N>>(moveTo(move));
+}
+
+//沿射线走到第一个占用格为止；射箭时起点已空出
+template <int N>
+void getAllValidMoves(const EnginePosition<N>& pos, int side, vector<PackedMove>& moves)
+{
+    const EngineTables<N>& t = engineTables<N>();
+    Bitboard<N> occupied = occupiedOf(pos);
+    Bitboard<N> queens = pos.queens[side];
+    moves.clear();
+    while (!isEmpty(queens))
+    {
+        int from = popLsb(queens);
+        Bitboard<N> lifted = occupied ^ squareBit<Bitboard<N>>(from);
+        for (int d = 0; d < 8; ++d)
+        {
+            for (int i = 0; i < t.rayLength[from][d]; ++i)
+            {
+                int to = t.rays[from][d][i];
+                if (testBit(occupied, to))
+                    break;
+                for (int ad = 0; ad < 8; ++ad)
+                {
+                    for (int j = 0; j < t.rayLength[to][ad]; ++j)
+                    {
+                        int arrow = t.rays[to][ad][j];
+                        if (testBit(lifted, arrow))
+                            break;
+                        moves.push_back((PackedMove)from | (PackedMove)to << 8 | (PackedMove)arrow << 16);
+                    }
+                }
+            }
+        }
+    }
+}
+
+//走子后皇后落点周围的空格数
+template <int N>
+int scoreMove(const EnginePosition<N>& pos, PackedMove move)
+{
+    const EngineTables<N>& t = engineTables<N>();
+    Bitboard<N> occupied = (occupiedOf(pos) ^ squareBit<Bitboard<N>>(moveFrom(move))) |
+        squareBit<Bitboard<N>>(moveTo(move)) | squareBit<Bitboard<N>>(moveArrow(move));
+    return popCount(t.neighbors[moveTo(move)] & ~occupied);
+}
+
+//评估项，每项都是黑方减白方；权重在 eval_weights.h，由 --tune 拟合
+enum EvalTerm
+{
+    TERM_ADJACENT,      //皇后周围的空格数
+    TERM_REACH,         //一步能走到的格子数
+    TERM_EXCLUSIVE,     //只有本方一步能走到的格子数
+    TERM_TRAPPED,       //周围没有空格的皇后数
+    EVAL_TERM_COUNT
+};
+
+static_assert(size(EVAL_WEIGHTS) == EVAL_TERM_COUNT, "eval_weights.h 与评估项个数不一致");
+
+//withReach 为 false 时跳过沿射线的两项，它们的权重为 0 时评估只需看邻格
+template <int N>
+void evalFeatures(const EnginePosition<N>& pos, int features[EVAL_TERM_COUNT], bool withReach = true)
+{
+    const EngineTables<N>& t = engineTables<N>();
+    Bitboard<N> occupied = occupiedOf(pos);
+    Bitboard<N> empty = ~occupied;
+    Bitboard<N> reach[2] = {};
+    int adjacent[2] = { 0, 0 };
+    int trapped[2] = { 0, 0 };
+    for (int side = 0; side < 2; ++side)
+    {
+        Bitboard<N> queens = pos.queens[side];
+        while (!isEmpty(queens))
+        {
+            int from = popLsb(queens);
+            int free = popCount(t.neighbors[from] & empty);
+            adjacent[side] += free;
+            trapped[side] += free == 0;
+            if (!withReach)
+                continue;
+            for (int d = 0; d < 8; ++d)
+            {
+                for (int i = 0; i < t.rayLength[from][d]; ++i)
+                {
+                    int to = t.rays[from][d][i];
+                    if (testBit(occupied, to))
+                        break;
+                    reach[side] |= squareBit<Bitboard<N>>(to);
+                }
+            }
+        }
+    }
+    features[TERM_ADJACENT] = adjacent[1] - adjacent[0];
+    features[TERM_REACH] = popCount(reach[1]) - popCount(reach[0]);
+    features[TERM_EXCLUSIVE] = popCount(reach[1] & ~reach[0]) - popCount(reach[0] & ~reach[1]);
+    features[TERM_TRAPPED] = trapped[1] - trapped[0];
+}
+
+//各评估项加权求和，黑方为正
+template <int N>
+int evaluateBoard(const EnginePosition<N>& pos)
+{
+    constexpr bool withReach = EVAL_WEIGHTS[TERM_REACH] != 0 || EVAL_WEIGHTS[TERM_EXCLUSIVE] != 0;
+    int features[EVAL_TERM_COUNT];
+    evalFeatures(pos, features, withReach);
+    int score = 0;
+    for (int i = 0; i < EVAL_TERM_COUNT; ++i)
+        score += EVAL_WEIGHTS[i] * features[i];
+    return score;
+}
+
+//批量评估与 NNUE 共用的 SIMD 内核选择
+#if defined(AMAZONS_NO_SIMD)
+const char SIMD_KERNEL[] = "scalar";
+#elif defined(__AVX2__)
+#define SIMD_AVX2
+const char SIMD_KERNEL[] = "AVX2";
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE2
+const char SIMD_KERNEL[] = "SSE2";
+#else
+const char SIMD_KERNEL[] = "scalar";
+#endif
+
+//8x8 前沿节点的批量评估：全部子局面按 SoA 存成三列 64 位位棋盘，一个向量同时装 WIDTH 个局面，
+//邻格用移位求出，射线用 Kogge-Stone 填充代替逐格走，popcount 按 64 位分道做；结果与 evaluateBoard 完全相同
+//每种指令集一组分道运算，V 为一个向量
+struct ScalarLanes
+{
+    typedef uint64_t V;
+    static const int WIDTH = 1;
+    static V load(const uint64_t* p) { return *p; }
+    static void store(uint64_t* p, V a) { *p = a; }
+    static V set1(uint64_t x) { return x; }
+    static V and_(V a, V b) { return a & b; }
+    static V or_(V a, V b) { return a | b; }
+    static V xor_(V a, V b) { return a ^ b; }
+    static V add(V a, V b) { return a + b; }
+    static V sub(V a, V b) { return a - b; }
+    template <int K> static V shl(V a) { return a << K; }
+    template <int K> static V shr(V a) { return a >> K; }
+    static V popcnt(V a) { return (V)popcount(a); }
+};
+
+#if defined(SIMD_SSE2) || defined(SIMD_AVX2)
+//SSE2/AVX2 没有 64 位 popcount：先按字节求位数，再用 SAD 把每 8 个字节加到一起
+struct Sse2Lanes
+{
+    typedef __m128i V;
+    static const int WIDTH = 2;
+    static V load(const uint64_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+    static void store(uint64_t* p, V a) { _mm_storeu_si128((__m128i*)p, a); }
+    static V set1(uint64_t x) { return _mm_set1_epi64x((long long)x); }
+    static V and_(V a, V b) { return _mm_and_si128(a, b); }
+    static V or_(V a, V b) { return _mm_or_si128(a, b); }
+    static V xor_(V a, V b) { return _mm_xor_si128(a, b); }
+    static V add(V a, V b) { return _mm_add_epi64(a, b); }
+    static V sub(V a, V b) { return _mm_sub_epi64(a, b); }
+    template <int K> static V shl(V a) { return _mm_slli_epi64(a, K); }
+    template <int K> static V shr(V a) { return _mm_srli_epi64(a, K); }
+    static V popcnt(V a)
+    {
+        a = _mm_sub_epi64(a, _mm_and_si128(_mm_srli_epi64(a, 1), _mm_set1_epi8(0x55)));
+        a = _mm_add_epi64(_mm_and_si128(a, _mm_set1_epi8(0x33)), _mm_and_si128(_mm_srli_epi64(a, 2), _mm_set1_epi8(0x33)));
+        a = _mm_and_si128(_mm_add_epi64(a, _mm_srli_epi64(a, 4)), _mm_set1_epi8(0x0F));
+        return _mm_sad_epu8(a, _mm_setzero_si128());
+    }
+};
+#endif
+
+#if defined(SIMD_AVX2)
+struct Avx2Lanes
+{
+    typedef __m256i V;
+    static const int WIDTH = 4;
+    static V load(const uint64_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    static void store(uint64_t* p, V a) { _mm256_storeu_si256((__m256i*)p, a); }
+    static V set1(uint64_t x) { return _mm256_set1_epi64x((long long)x); }
+    static V and_(V a, V b) { return _mm256_and_si256(a, b); }
+    static V or_(V a, V b) { return _mm256_or_si256(a, b); }
+    static V xor_(V a, V b) { return _mm256_xor_si256(a, b); }
+    static V add(V a, V b) { return _mm256_add_epi64(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_epi64(a, b); }
+    template <int K> static V shl(V a) { return _mm256_slli_epi64(a, K); }
+    template <int K> static V shr(V a) { return _mm256_srli_epi64(a, K); }
+    static V popcnt(V a)
+    {
+        a = _mm256_sub_epi64(a, _mm256_and_si256(_mm256_srli_epi64(a, 1), _mm256_set1_epi8(0x55)));
+        a = _mm256_add_epi64(_mm256_and_si256(a, _mm256_set1_epi8(0x33)), _mm256_and_si256(_mm256_srli_epi64(a, 2), _mm256_set1_epi8(0x33)));
+        a = _mm256_and_si256(_mm256_add_epi64(a, _mm256_srli_epi64(a, 4)), _mm256_set1_epi8(0x0F));
+        return _mm256_sad_epu8(a, _mm256_setzero_si256());
+    }
+};
+typedef Avx2Lanes LeafLanes;
+#elif defined(SIMD_SSE2)
+typedef Sse2Lanes LeafLanes;
+#else
+typedef ScalarLanes LeafLanes;
+#endif
+
+const int LEAF_BATCH_WIDTH = LeafLanes::WIDTH;
+const int LEAF_BATCH_BLOCK = 16;      //前沿节点每次评估的子局面数，截断常在前几手发生
+static_assert(LEAF_BATCH_BLOCK % LEAF_BATCH_WIDTH == 0, "块长须为向量宽度的整数倍");
+const uint64_t NOT_FILE_A = 0xFEFEFEFEFEFEFEFEull;     //去掉第 0 列，向列号增大方向移位后用
+const uint64_t NOT_FILE_H = 0x7F7F7F7F7F7F7F7Full;     //去掉第 7 列
+
+//第 i 个子局面为 (queens[0][i], queens[1][i], arrows[i])，长度补齐到 LEAF_BATCH_WIDTH 的整数倍
+struct LeafBatch
+{
+    vector<uint64_t> queens[2];
+    vector<uint64_t> arrows;
+    vector<uint64_t> features[EVAL_TERM_COUNT];     //黑方减白方，按补码存
+    vector<int> scores;
+};
+
+inline size_t resizeLeafBatch(LeafBatch& batch, size_t count)
+{
+    size_t padded = (count + LEAF_BATCH_WIDTH - 1) / LEAF_BATCH_WIDTH * LEAF_BATCH_WIDTH;
+    batch.queens[0].resize(padded);
+    batch.queens[1].resize(padded);
+    batch.arrows.resize(padded);
+    for (int i = 0; i < EVAL_TERM_COUNT; ++i)
+        batch.features[i].resize(padded);
+    batch.scores.resize(padded);
+    return padded;
+}
+
+//8x8 上按格号整体移位 S 格，S 为负时右移
+template <class L, int S>
+typename L::V shiftLanes(typename L::V a)
+{
+    if constexpr (S > 0)
+        return L::template shl<S>(a);
+    else
+        return L::template shr<-S>(a);
+}
+
+template <class L>
+typename L::V neighborLanes(typename L::V bits)
+{
+    typename L::V row = L::or_(L::and_(L::template shl<1>(bits), L::set1(NOT_FILE_A)),
+        L::and_(L::template shr<1>(bits), L::set1(NOT_FILE_H)));
+    typename L::V wide = L::or_(row, bits);
+    return L::or_(row, L::or_(L::template shl<8>(wide), L::template shr<8>(wide)));
+}
+
+//一个方向上从 queens 出发能走到的空格；mask 去掉移位时跨行绕回的那一列
+template <class L, int S>
+typename L::V rayLanes(typename L::V queens, typename L::V empty, uint64_t mask)
+{
+    typename L::V open = L::and_(empty, L::set1(mask));
+    typename L::V pass = open;
+    queens = L::or_(queens, L::and_(pass, shiftLanes<L, S>(queens)));
+    pass = L::and_(pass, shiftLanes<L, S>(pass));
+    queens = L::or_(queens, L::and_(pass, shiftLanes<L, 2 * S>(queens)));
+    pass = L::and_(pass, shiftLanes<L, 2 * S>(pass));
+    queens = L::or_(queens, L::and_(pass, shiftLanes<L, 4 * S>(queens)));
+    return L::and_(open, shiftLanes<L, S>(queens));
+}
+
+template <class L>
+typename L::V reachLanes(typename L::V queens, typename L::V empty)
+{
+    const uint64_t all = ~0ull;
+    return L::or_(
+        L::or_(L::or_(rayLanes<L, 1>(queens, empty, NOT_FILE_A), rayLanes<L, -1>(queens, empty, NOT_FILE_H)),
+            L::or_(rayLanes<L, 8>(queens, empty, all), rayLanes<L, -8>(queens, empty, all))),
+        L::or_(L::or_(rayLanes<L, 9>(queens, empty, NOT_FILE_A), rayLanes<L, 7>(queens, empty, NOT_FILE_H)),
+            L::or_(rayLanes<L, -7>(queens, empty, NOT_FILE_A), rayLanes<L, -9>(queens, empty, NOT_FILE_H))));
+}
+
+//每轮取出每个分道的最低位皇后，轮数取本组各分道中该方皇后数的最大值，所以不假定每方正好 4 个皇后
+//（自定义开局或旧存档可能多于或少于 4 个），结果总与 evaluateBoard 一致；分道里皇后不足时多出的轮次不计入
+template <class L>
+void evaluateLeafBatchWith(LeafBatch& batch, size_t begin, size_t end)
+{
+    typedef typename L::V V;
+    constexpr bool withReach = EVAL_WEIGHTS[TERM_REACH] != 0 || EVAL_WEIGHTS[TERM_EXCLUSIVE] != 0;
+    const V zero = L::set1(0);
+    const V one = L::set1(1);
+    for (size_t i = begin; i < end; i += L::WIDTH)
+    {
+        V queens[2] = { L::load(&batch.queens[0][i]), L::load(&batch.queens[1][i]) };
+        V empty = L::xor_(L::or_(L::or_(queens[0], queens[1]), L::load(&batch.arrows[i])), L::set1(~0ull));
+        V adjacent[2], trapped[2], reach[2] = { zero, zero };
+        for (int side = 0; side < 2; ++side)
+        {
+            V rest = queens[side];
+            adjacent[side] = zero;
+            trapped[side] = zero;
+            int rounds = 0;
+            for (int lane = 0; lane < L::WIDTH; ++lane)
+                rounds = max(rounds, popcount(batch.queens[side][i + lane]));
+            for (int k = 0; k < rounds; ++k)
+            {
+                V bit = L::and_(rest, L::sub(zero, rest));
+                rest = L::xor_(rest, bit);
+                V free = L::popcnt(L::and_(neighborLanes<L>(bit), empty));
+                adjacent[side] = L::add(adjacent[side], free);
+                //free - 1 的最高位表示 free 为 0，-bit 的最高位表示 bit 非 0
+                V isTrapped = L::and_(L::template shr<63>(L::sub(free, one)), L::template shr<63>(L::sub(zero, bit)));
+                trapped[side] = L::add(trapped[side], isTrapped);
+            }
+            if (withReach)
+                reach[side] = reachLanes<L>(queens[side], empty);
+        }
+        L::store(&batch.features[TERM_ADJACENT][i], L::sub(adjacent[1], adjacent[0]));
+        L::store(&batch.features[TERM_TRAPPED][i], L::sub(trapped[1], trapped[0]));
+        if (withReach)
+        {
+            V common = L::and_(reach[0], reach[1]);
+            L::store(&batch.features[TERM_REACH][i], L::sub(L::popcnt(reach[1]), L::popcnt(reach[0])));
+            L::store(&batch.features[TERM_EXCLUSIVE][i],
+                L::sub(L::popcnt(L::xor_(reach[1], common)), L::popcnt(L::xor_(reach[0], common))));
+        }
+    }
+    for (size_t i = begin; i < end; ++i)
+    {
+        int64_t score = 0;
+        for (int t = 0; t < EVAL_TERM_COUNT; ++t)
+            if (EVAL_WEIGHTS[t] != 0)
+                score += EVAL_WEIGHTS[t] * (int64_t)batch.features[t][i];
+        batch.scores[i] = (int)score;
+    }
+}
+
+//算出 [begin, end) 子局面的 evaluateBoard 分数（黑方为正），写入 batch.scores；begin 须为 LEAF_BATCH_WIDTH 的倍数
+inline void evaluateLeafBatch(LeafBatch& batch, size_t begin, size_t end)
+{
+    evaluateLeafBatchWith<LeafLanes>(batch, begin, end);
+}
+
+//可选的小型神经网络评估（NNUE）：输入为 白后/黑后/箭 三个平面上的格子，以及“皇后 + 方向”特征
+//（皇后在该方向的邻格被占或出界时有效，让网络能表达行动力），第一层的累加器随走子增量更新，之后两层用 int8/int16 定点运算，输出与 evaluateBoard 同单位（黑方为正）
+//  累加器 int16[NNUE_HIDDEN] -> 截断到 [0,127] -> int8 权重 -> int32[NNUE_L2] >> NNUE_HIDDEN_SHIFT
+//  -> 截断到 [0,127] -> int16 权重 -> 除以 output_divisor
+const int NNUE_HIDDEN = 64;
+const int NNUE_L2 = 16;
+const int NNUE_PLANES = 3;
+const int NNUE_HIDDEN_SHIFT = 6;
+const char NNUE_MAGIC[4] = { 'A', 'M', 'N', 'N' };
+const uint16_t NNUE_VERSION = 1;
+const string NNUE_FILE_NAME = "amazons_nnue.bin";
+
+//网络文件：NnueHeader 之后依次是 输入权重（按特征连续）、输入偏置、隐层权重、隐层偏置、输出权重、输出偏置
+#pragma pack(push, 1)
+struct NnueHeader
+{
+    char magic[4];
+    uint16_t version;
+    uint8_t board_size;
+    uint8_t reserved;
+    uint16_t hidden;
+    uint16_t l2;
+    int32_t output_divisor;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(NnueHeader) == 16, "网络文件头布局不能改变");
+
+struct NnueNetwork
+{
+    bool loaded;
+    int boardSize;
+    vector<int16_t> inputWeights;   //特征数 × NNUE_HIDDEN
+    int16_t inputBias[NNUE_HIDDEN];
+    alignas(32) int8_t hiddenWeights[NNUE_L2][NNUE_HIDDEN];
+    int32_t hiddenBias[NNUE_L2];
+    int16_t outputWeights[NNUE_L2];
+    int32_t outputBias;
+    int32_t outputDivisor;
+};
+
+struct NnueAccumulator
+{
+    alignas(32) int16_t values[NNUE_HIDDEN];
+};
+
+//每种棋盘大小一个网络，启动时从当前目录加载，没有网络文件时 --search nnue=1 退回 evaluateBoard
+NnueNetwork nnueNetworks[MAX_BOARD_SIZE + 1];
+
+string nnueFileName(int size)
+{
+    return size == DEFAULT_BOARD_SIZE ? NNUE_FILE_NAME : "amazons_nnue_" + to_string(size) + ".bin";
+}
+
+int nnueFeatureCount(int size)
+{
+    return NNUE_PLANES * size * size + 2 * size * size * 8;
+}
+
+//同时有效的特征数上限：每个被占的格子一个平面特征，8 个皇后各 8 个方向特征
+int nnueMaxActive(int size)
+{
+    return size * size + 8 * 8;
+}
+
+//第一层量化后权重和偏置的绝对值上限：偏置加上全部有效特征也不会超出 int16 累加器
+int nnueInputLimit(int size)
+{
+    return 32767 / (nnueMaxActive(size) + 1);
+}
+
+bool loadNnueNetwork(NnueNetwork& net, const string& path, int size)
+{
+    net.loaded = false;
+    vector<uint8_t> bytes;
+    if (!readFileBytes(path, bytes))
+        return false;
+    size_t features = nnueFeatureCount(size);
+    size_t expected = sizeof(NnueHeader) + features * NNUE_HIDDEN * 2 + NNUE_HIDDEN * 2 +
+        NNUE_L2 * NNUE_HIDDEN + NNUE_L2 * 4 + NNUE_L2 * 2 + 4;
+    const NnueHeader* header = (const NnueHeader*)bytes.data();
+    if (bytes.size() != expected || !equal(NNUE_MAGIC, NNUE_MAGIC + 4, header->magic) ||
+        header->version != NNUE_VERSION || header->board_size != size || header->hidden != NNUE_HIDDEN ||
+        header->l2 != NNUE_L2 || header->output_divisor <= 0)
+    {
+        cerr << "错误：网络文件 " << path << " 格式不正确。" << endl;
+        return false;
+    }
+
+    const uint8_t* p = bytes.data() + sizeof(NnueHeader);
+    net.boardSize = size;
+    net.outputDivisor = header->output_divisor;
+    net.inputWeights.resize(features * NNUE_HIDDEN);
+    int limit = nnueInputLimit(size);
+    for (int16_t& w : net.inputWeights)
+        w = (int16_t)getU16(p), p += 2;
+    for (int16_t& b : net.inputBias)
+        b = (int16_t)getU16(p), p += 2;
+    auto tooLarge = [limit](int16_t v) { return abs((int)v) > limit; };
+    if (any_of(net.inputWeights.begin(), net.inputWeights.end(), tooLarge) ||
+        any_of(net.inputBias, net.inputBias + NNUE_HIDDEN, tooLarge))
+    {
+        cerr << "错误：网络文件 " << path << " 的第一层权重超过 " << limit << "，累加器可能溢出。" << endl;
+        return false;
+    }
+    for (auto& row : net.hiddenWeights)
+        for (int8_t& w : row)
+            w = (int8_t)*p++;
+    for (int32_t& b : net.hiddenBias)
+        b = (int32_t)getU32(p), p += 4;
+    for (int16_t& w : net.outputWeights)
+        w = (int16_t)getU16(p), p += 2;
+    net.outputBias = (int32_t)getU32(p);
+    net.loaded = true;
+    return true;
+}
+
+bool writeNnueNetwork(const string& path, const NnueNetwork& net)
+{
+    vector<uint8_t> out(NNUE_MAGIC, NNUE_MAGIC + 4);
+    putU16(out, NNUE_VERSION);
+    out.push_back((uint8_t)net.boardSize);
+    out.push_back(0);
+    putU16(out, NNUE_HIDDEN);
+    putU16(out, NNUE_L2);
+    putU32(out, (uint32_t)net.outputDivisor);
+    for (int16_t w : net.inputWeights)
+        putU16(out, (uint16_t)w);
+    for (int16_t b : net.inputBias)
+        putU16(out, (uint16_t)b);
+    for (const auto& row : net.hiddenWeights)
+        for (int8_t w : row)
+            out.push_back((uint8_t)w);
+    for (int32_t b : net.hiddenBias)
+        putU32(out, (uint32_t)b);
+    for (int16_t w : net.outputWeights)
+        putU16(out, (uint16_t)w);
+    putU32(out, (uint32_t)net.outputBias);
+    ofstream file(path, ios::binary | ios::trunc);
+    if (!file.is_open())
+    {
+        cerr << "错误：无法写入网络文件 " << path << endl;
+        return false;
+    }
+    file.write((const char*)out.data(), out.size());
+    return file.good();
+}
+
+//平面 0 白后、1 黑后、2 箭
+inline int nnueFeature(int plane, int sq, int size)
+{
+    return plane * size * size + sq;
+}
+
+//side 方在 sq 的皇后，DIRECTIONS[dir] 方向的邻格被堵
+inline int nnueBlockedFeature(int side, int sq, int dir, int size)
+{
+    return NNUE_PLANES * size * size + (side * size * size + sq) * 8 + dir;
+}
+
+template <int N>
+bool isBlocked(const EngineTables<N>& t, Bitboard<N> occupied, int sq, int dir)
+{
+    return t.rayLength[sq][dir] == 0 || testBit(occupied, t.rays[sq][dir][0]);
+}
+
+template <int N>
+void nnueActiveFeatures(const EnginePosition<N>& pos, vector<int>& active)
+{
+    const EngineTables<N>& t = engineTables<N>();
+    Bitboard<N> occupied = occupiedOf(pos);
+    Bitboard<N> planes[NNUE_PLANES] = { pos.queens[0], pos.queens[1], pos.arrows };
+    active.clear();
+    for (int plane = 0; plane < NNUE_PLANES; ++plane)
+        while (!isEmpty(planes[plane]))
+        {
+            int sq = popLsb(planes[plane]);
+            active.push_back(nnueFeature(plane, sq, N));
+            if (plane == NNUE_PLANES - 1)
+                continue;
+            for (int d = 0; d < 8; ++d)
+                if (isBlocked(t, occupied, sq, d))
+                    active.push_back(nnueBlockedFeature(plane, sq, d, N));
+        }
+}
+
+//累加器加减一列 int16 权重，按二进制补码回绕，加上再减去总能精确还原
+inline void nnueAddFeature(const NnueNetwork& net, NnueAccumulator& acc, int feature)
+{
+    const int16_t* w = &net.inputWeights[(size_t)feature * NNUE_HIDDEN];
+#if defined(SIMD_AVX2)
+    for (int i = 0; i < NNUE_HIDDEN; i += 16)
+    {
+        __m256i* a = (__m256i*)&acc.values[i];
+        _mm256_store_si256(a, _mm256_add_epi16(_mm256_load_si256(a), _mm256_loadu_si256((const __m256i*)&w[i])));
+    }
+#elif defined(SIMD_SSE2)
+    for (int i = 0; i < NNUE_HIDDEN; i += 8)
+    {
+        __m128i* a = (__m128i*)&acc.values[i];
+        _mm_store_si128(a, _mm_add_epi16(_mm_load_si128(a), _mm_loadu_si128((const __m128i*)&w[i])));
+    }
+#else
+    for (int i = 0; i < NNUE_HIDDEN; ++i)
+        acc.values[i] = (int16_t)(acc.values[i] + w[i]);
+#endif
+}
+
+inline void nnueSubFeature(const NnueNetwork& net, NnueAccumulator& acc, int feature)
+{
+    const int16_t* w = &net.inputWeights[(size_t)feature * NNUE_HIDDEN];
+#if defined(SIMD_AVX2)
+    for (int i = 0; i < NNUE_HIDDEN; i += 16)
+    {
+        __m256i* a = (__m256i*)&acc.values[i];
+        _mm256_store_si256(a, _mm256_sub_epi16(_mm256_load_si256(a), _mm256_loadu_si256((const __m256i*)&w[i])));
+    }
+#elif defined(SIMD_SSE2)
+    for (int i = 0; i < NNUE_HIDDEN; i += 8)
+    {
+        __m128i* a = (__m128i*)&acc.values[i];
+        _mm_store_si128(a, _mm_sub_epi16(_mm_load_si128(a), _mm_loadu_si128((const __m128i*)&w[i])));
+    }
+#else
+    for (int i = 0; i < NNUE_HIDDEN; ++i)
+        acc.values[i] = (int16_t)(acc.values[i] - w[i]);
+#endif
+}
+
+template <int N>
+void nnueRefresh(const NnueNetwork& net, const EnginePosition<N>& pos, NnueAccumulator& acc)
+{
+    static thread_local vector<int> active;
+    copy(net.inputBias, net.inputBias + NNUE_HIDDEN, acc.values);
+    nnueActiveFeatures(pos, active);
+    for (int feature : active)
+        nnueAddFeature(net, acc, feature);
+}
+
+//一步棋引起的特征变化，最多：三个平面特征、走动皇后的 8+8 个方向特征、三个变化格周围各 8 个皇后
+struct NnueDelta
+{
+    int added[48];
+    int removed[48];
+    int addedCount;
+    int removedCount;
+};
+
+//before 为走子前的局面
+//走动的皇后整体换掉方向特征；其余皇后只有邻格是 起点/终点/箭 之一时才可能变化
+template <int N>
+void nnueMoveDelta(const EnginePosition<N>& before, PackedMove move, int side, NnueDelta& delta)
+{
+    const EngineTables<N>& t = engineTables<N>();
+    int from = moveFrom(move), to = moveTo(move), arrow = moveArrow(move);
+    Bitboard<N> occ0 = occupiedOf(before);
+    Bitboard<N> occ1 = (occ0 ^ squareBit<Bitboard<N>>(from) ^ squareBit<Bitboard<N>>(to)) | squareBit<Bitboard<N>>(arrow);
+    delta.addedCount = delta.removedCount = 0;
+    delta.removed[delta.removedCount++] = nnueFeature(side, from, N);
+    delta.added[delta.addedCount++] = nnueFeature(side, to, N);
+    delta.added[delta.addedCount++] = nnueFeature(2, arrow, N);
+    for (int d = 0; d < 8; ++d)
+    {
+        if (isBlocked(t, occ0, from, d))
+            delta.removed[delta.removedCount++] = nnueBlockedFeature(side, from, d, N);
+        if (isBlocked(t, occ1, to, d))
+            delta.added[delta.addedCount++] = nnueBlockedFeature(side, to, d, N);
+    }
+
+    Bitboard<N> others[2] = { before.queens[0], before.queens[1] };
+    others[side] ^= squareBit<Bitboard<N>>(from);
+    int changed[3] = { from, to, arrow };
+    int changedCount = arrow == from ? 2 : 3;
+    for (int c = 0; c < changedCount; ++c)
+    {
+        int sq = changed[c];
+        bool was = testBit(occ0, sq), now = testBit(occ1, sq);
+        if (was == now)
+            continue;
+        for (int d = 0; d < 8; ++d)
+        {
+            if (t.rayLength[sq][d] == 0)
+                continue;
+            int q = t.rays[sq][d][0];
+            for (int s = 0; s < 2; ++s)
+                if (testBit(others[s], q))
+                {
+                    //从 q 看 sq 是相反方向
+                    int feature = nnueBlockedFeature(s, q, d ^ 1, N);
+                    if (now)
+                        delta.added[delta.addedCount++] = feature;
+                    else
+                        delta.removed[delta.removedCount++] = feature;
+                }
+        }
+    }
+}
+
+//undo 为 true 时 before 仍是走子前的局面（先撤销棋盘再撤销累加器）
+template <int N>
+void nnueApplyMove(const NnueNetwork& net, NnueAccumulator& acc, const EnginePosition<N>& before,
+    PackedMove move, int side, bool undo)
+{
+    NnueDelta delta;
+    nnueMoveDelta(before, move, side, delta);
+    for (int i = 0; i < delta.addedCount; ++i)
+    {
+        if (undo)
+            nnueSubFeature(net, acc, delta.added[i]);
+        else
+            nnueAddFeature(net, acc, delta.added[i]);
+    }
+    for (int i = 0; i < delta.removedCount; ++i)
+    {
+        if (undo)
+            nnueAddFeature(net, acc, delta.removed[i]);
+        else
+            nnueSubFeature(net, acc, delta.removed[i]);
+    }
+}
+
+#if defined(SIMD_AVX2)
+inline int32_t horizontalSum(__m256i v)
+{
+    __m128i x = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    x = _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2)));
+    x = _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(x);
+}
+
+//累加器截断成 uint8 后与 int8 权重做 maddubs，每对乘积之和不超过 2*127*128，不会饱和
+void nnueHiddenLayer(const NnueNetwork& net, const NnueAccumulator& acc, int32_t out[NNUE_L2])
+{
+    const __m256i limit = _mm256_set1_epi8(127);
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i input[NNUE_HIDDEN / 32];
+    for (int k = 0; k < NNUE_HIDDEN / 32; ++k)
+    {
+        __m256i a = _mm256_load_si256((const __m256i*)&acc.values[k * 32]);
+        __m256i b = _mm256_load_si256((const __m256i*)&acc.values[k * 32 + 16]);
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+        input[k] = _mm256_min_epu8(packed, limit);
+    }
+    for (int j = 0; j < NNUE_L2; ++j)
+    {
+        __m256i sum = _mm256_setzero_si256();
+        for (int k = 0; k < NNUE_HIDDEN / 32; ++k)
+        {
+            __m256i w = _mm256_load_si256((const __m256i*)&net.hiddenWeights[j][k * 32]);
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_maddubs_epi16(input[k], w), ones));
+        }
+        out[j] = net.hiddenBias[j] + horizontalSum(sum);
+    }
+}
+#elif defined(SIMD_SSE2)
+inline int32_t horizontalSum(__m128i x)
+{
+    x = _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2)));
+    x = _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(x);
+}
+
+//SSE2 没有 maddubs：激活保持 int16，权重符号扩展成 int16 后用 madd
+void nnueHiddenLayer(const NnueNetwork& net, const NnueAccumulator& acc, int32_t out[NNUE_L2])
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i limit = _mm_set1_epi16(127);
+    __m128i input[NNUE_HIDDEN / 8];
+    for (int k = 0; k < NNUE_HIDDEN / 8; ++k)
+    {
+        __m128i a = _mm_load_si128((const __m128i*)&acc.values[k * 8]);
+        input[k] = _mm_min_epi16(_mm_max_epi16(a, zero), limit);
+    }
+    for (int j = 0; j < NNUE_L2; ++j)
+    {
+        __m128i sum = _mm_setzero_si128();
+        for (int k = 0; k < NNUE_HIDDEN / 16; ++k)
+        {
+            __m128i w = _mm_load_si128((const __m128i*)&net.hiddenWeights[j][k * 16]);
+            __m128i sign = _mm_cmplt_epi8(w, zero);
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(input[2 * k], _mm_unpacklo_epi8(w, sign)));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(input[2 * k + 1], _mm_unpackhi_epi8(w, sign)));
+        }
+        out[j] = net.hiddenBias[j] + horizontalSum(sum);
+    }
+}
+#else
+void nnueHiddenLayer(const NnueNetwork& net, const NnueAccumulator& acc, int32_t out[NNUE_L2])
+{
+    int32_t input[NNUE_HIDDEN];
+    for (int i = 0; i < NNUE_HIDDEN; ++i)
+        input[i] = min<int32_t>(max<int32_t>(acc.values[i], 0), 127);
+    for (int j = 0; j < NNUE_L2; ++j)
+    {
+        int32_t sum = net.hiddenBias[j];
+        for (int i = 0; i < NNUE_HIDDEN; ++i)
+            sum += input[i] * net.hiddenWeights[j][i];
+        out[j] = sum;
+    }
+}
+#endif
+
+//三种实现的整数结果完全一致
+int nnueEvaluate(const NnueNetwork& net, const NnueAccumulator& acc)
+{
+    int32_t hidden[NNUE_L2];
+    nnueHiddenLayer(net, acc, hidden);
+    int32_t sum = net.outputBias;
+    for (int j = 0; j < NNUE_L2; ++j)
+        sum += min(max(hidden[j] >> NNUE_HIDDEN_SHIFT, 0), 127) * net.outputWeights[j];
+    return sum / net.outputDivisor;
+}
+
+const int INF_SCORE = 1000000;
+const int WIN_THRESHOLD = INF_SCORE - 1000;     //绝对值超过它的分数表示必胜/必败，随层数变化
+const int ASPIRATION_WINDOW = 4 * EVAL_SCALE;
+
+//置换表：服务器的全部搜索线程共用一张，读写不加锁
+//每项存 key ^ data 和 data 两个字，两个线程交错写入同一项时异或校验对不上，当作未命中
+//  data：着法 24 位 | 深度 6 位 | 界类型 2 位 | 分数 32 位
+enum TtBound
+{
+    TT_NONE,
+    TT_UPPER,       //分数不高于记录值
+    TT_LOWER,       //分数不低于记录值
+    TT_EXACT
+};
+
+struct TtEntry
+{
+    atomic<uint64_t> check;
+    atomic<uint64_t> data;
+};
+
+struct TranspositionTable
+{
+    unique_ptr<TtEntry[]> entries;
+    size_t mask;
+};
+
+struct TtHit
+{
+    PackedMove move;
+    int score;
+    int depth;
+    int bound;
+};
+
+//项数取不超过 megabytes 的 2 的幂
+void initTranspositionTable(TranspositionTable& tt, size_t megabytes)
+{
+    size_t count = 1;
+    while (count * 2 * sizeof(TtEntry) <= max<size_t>(megabytes, 1) << 20)
+        count *= 2;
+    tt.entries.reset(new TtEntry[count]);
+    tt.mask = count - 1;
+    for (size_t i = 0; i < count; ++i)
+    {
+        tt.entries[i].check.store(0, memory_order_relaxed);
+        tt.entries[i].data.store(0, memory_order_relaxed);
+    }
+}
+
+bool probeTransposition(const TranspositionTable& tt, uint64_t key, TtHit& hit)
+{
+    const TtEntry& entry = tt.entries[key & tt.mask];
+    uint64_t data = entry.data.load(memory_order_relaxed);
+    if ((entry.check.load(memory_order_relaxed) ^ data) != key || data == 0)
+        return false;
+    hit.move = (PackedMove)(data & 0xFFFFFF);
+    hit.depth = (int)(data >> 24) & 63;
+    hit.bound = (int)(data >> 30) & 3;
+    hit.score = (int32_t)(uint32_t)(data >> 32);
+    return true;
+}
+
+//同一局面已有更深的记录时只让精确值覆盖，其余情况直接覆盖
+void storeTransposition(TranspositionTable& tt, uint64_t key, PackedMove move, int score, int depth, int bound)
+{
+    TtEntry& entry = tt.entries[key & tt.mask];
+    uint64_t old = entry.data.load(memory_order_relaxed);
+    if ((entry.check.load(memory_order_relaxed) ^ old) == key && (int)(old >> 24 & 63) > depth && bound != TT_EXACT)
+        return;
+    uint64_t data = (uint64_t)(move & 0xFFFFFF) | (uint64_t)min(depth, 63) << 24 | (uint64_t)bound << 30 |
+        (uint64_t)(uint32_t)score << 32;
+    entry.data.store(data, memory_order_relaxed);
+    entry.check.store(key ^ data, memory_order_relaxed);
+}
+
+//必胜/必败分数在表里按“距该节点的步数”存，取出时换回“距根的步数”
+inline int scoreToTable(int score, int ply)
+{
+    return score <= -WIN_THRESHOLD ? score - ply : score >= WIN_THRESHOLD ? score + ply : score;
+}
+
+inline int scoreFromTable(int score, int ply)
+{
+    return score <= -WIN_THRESHOLD ? score + ply : score >= WIN_THRESHOLD ? score - ply : score;
+}
+
+//选择性搜索参数，命令行 --search 可以调整
+//maxTargets/maxArrows 为 0 表示不剪枝，lmrReduction 为 0 表示不做后期着法缩减
+struct SearchOptions
+{
+    int depth;          //迭代加深的最大深度
+    int maxTargets;     //每个节点最多展开的皇后落点数
+    int maxArrows;      //每个落点最多展开的射箭格数
+    int lmrMinDepth;    //剩余深度不小于此值才缩减
+    int lmrFullMoves;   //排在前面的这么多手不缩减
+    int lmrReduction;   //缩减的层数
+    int nnue;           //非 0 且已加载网络时用 NNUE 评估
+};
+
+const SearchOptions DEFAULT_SEARCH_OPTIONS = { 4, 20, 8, 4, 8, 1, 0 };
+const SearchOptions FULL_WIDTH_SEARCH = { AI_SEARCH_DEPTH, 0, 0, 0, 0, 0, 0 };
+SearchOptions searchOptions = DEFAULT_SEARCH_OPTIONS;
+
+//"full,depth=3,targets=16" 这样的逗号分隔列表，default/full 先重置为对应的预设
+bool parseSearchOptions(const string& spec, SearchOptions& options)
+{
+    stringstream ss(spec);
+    string item;
+    while (getline(ss, item, ','))
+    {
+        if (item == "default")
+        {
+            options = DEFAULT_SEARCH_OPTIONS;
+            continue;
+        }
+        if (item == "full")
+        {
+            options = FULL_WIDTH_SEARCH;
+            continue;
+        }
+        size_t eq = item.find('=');
+        if (eq == string::npos)
+        {
+            cerr << "错误：搜索参数格式应为 名称=数值：" << item << endl;
+            return false;
+        }
+        string key = item.substr(0, eq);
+        int value = atoi(item.c_str() + eq + 1);
+        if (value < 0)
+        {
+            cerr << "错误：搜索参数不能为负数：" << item << endl;
+            return false;
+        }
+        if (key == "depth" && value > 0)
+            options.depth = value;
+        else if (key == "targets")
+            options.maxTargets = value;
+        else if (key == "arrows")
+            options.maxArrows = value;
+        else if (key == "lmr-depth")
+            options.lmrMinDepth = value;
+        else if (key == "lmr-moves")
+            options.lmrFullMoves = value;
+        else if (key == "lmr")
+            options.lmrReduction = value;
+        else if (key == "nnue")
+            options.nnue = value;
+        else
+        {
+            cerr << "错误：未知的搜索参数：" << item << endl;
+            cerr << "可用参数：depth, targets, arrows, lmr-depth, lmr-moves, lmr, nnue" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+string describeSearchOptions(const SearchOptions& options)
+{
+    return "depth=" + to_string(options.depth) + ",targets=" + to_string(options.maxTargets) +
+        ",arrows=" + to_string(options.maxArrows) + ",lmr-depth=" + to_string(options.lmrMinDepth) +
+        ",lmr-moves=" + to_string(options.lmrFullMoves) + ",lmr=" + to_string(options.lmrReduction) + ",nnue=" + to_string(options.nnue);
+}
+
+//对局时钟：每方总时间 + 每步加秒，命令行 --clock 设置，totalMs 为 0 表示不计时
+struct TimeControl
+{
+    int64_t totalMs;
+    int64_t incrementMs;
+};
+
+TimeControl gameClock = { 0, 0 };
+
+//"300" 或 "300+2"，单位为秒
+bool parseTimeControl(const string& spec, TimeControl& clock)
+{
+    double total = 0, increment = 0;
+    char plus = 0;
+    stringstream ss(spec);
+    if (!(ss >> total) || total <= 0 || ((ss >> plus) && (plus != '+' || !(ss >> increment) || increment < 0)))
+    {
+        cerr << "错误：时钟格式应为 总秒数[+每步加秒]：" << spec << endl;
+        return false;
+    }
+    clock = { (int64_t)(total * 1000), (int64_t)(increment * 1000) };
+    return true;
+}
+
+//一步的用时：到软限后不再开始新一轮迭代，到硬限立即中断
+struct TimeBudget
+{
+    int64_t softMs;
+    int64_t hardMs;
+};
+
+const int64_t MOVE_OVERHEAD_MS = 30;        //留给界面、通信和线程调度的余量
+const int MIN_MOVES_TO_GO = 4;
+const int64_t HARD_LIMIT_FACTOR = 4;        //硬限最多为软限的这么多倍
+const double NEXT_ITERATION_SHARE = 0.5;    //下一轮通常比之前所有轮加起来还久，用掉软限的一半就不再开始
+const double UNSTABLE_TIME_FACTOR = 2.0;    //最佳着法刚变过，软限放宽
+const double DOMINANT_TIME_FACTOR = 0.3;    //最佳着法领先其余着法很多，软限收紧
+const int DOMINANCE_MARGIN = 8 * EVAL_SCALE;
+const int TIMED_SEARCH_DEPTH = 32;          //计时搜索只受时间限制
+
+//剩余步数按空格数估计：每步射一支箭，对局多半下到棋盘接近填满，己方大约还能走 空格数/2 步
+//硬限不超过剩余时间的三分之一加一次加秒，连续几步都用到硬限也不会超时
+TimeBudget allocateMoveTime(int64_t remainingMs, int64_t incrementMs, int emptySquares)
+{
+    int64_t usable = max<int64_t>(remainingMs - MOVE_OVERHEAD_MS, 1);
+    int movesToGo = max(MIN_MOVES_TO_GO, emptySquares / 2);
+    int64_t soft = min(usable, usable / movesToGo + incrementMs * 3 / 4);
+    int64_t hard = min(usable, min(soft * HARD_LIMIT_FACTOR, usable / 3 + incrementMs));
+    return { max<int64_t>(soft, 1), max<int64_t>(hard, soft) };
+}
+
+int countEmptySquares(const Board& board)
+{
+    int empty = 0;
+    for (const auto& row : board)
+        empty += (int)count(row.begin(), row.end(), (int)EMPTY);
+    return empty;
+}
+
+SearchOptions timedSearchOptions(const SearchOptions& options)
+{
+    SearchOptions timed = options;
+    timed.depth = TIMED_SEARCH_DEPTH;
+    return timed;
+}
+
+//一次搜索的全部状态；每层一块着法缓冲区，搜索过程中不再分配内存
+template <int N>
+struct SearchContext
+{
+    EnginePosition<N> pos;
+    SearchOptions options;
+    vector<vector<pair<int, PackedMove>>> moveStack;
+    vector<vector<PackedMove>> pv;      //pv[ply] 为该层当前最佳的着法序列
+    vector<PackedMove> generated;
+    vector<pair<int, PackedMove>> targets;
+    vector<pair<int, PackedMove>> arrows;
+    const NnueNetwork* network;         //为空时用 evaluateBoard
+    NnueAccumulator accumulator;
+    LeafBatch batch;                    //8x8 前沿节点的子局面
+    TranspositionTable* table;          //为空时不用置换表
+    uint64_t hash;                      //棋子部分的 Zobrist 哈希，不含行棋方
+    bool hasDeadline;
+    chrono::steady_clock::time_point deadline;
+    uint64_t nextClockCheck;
+    int completedDepth;                 //最近一轮完整搜完的深度
+    bool stopped;                       //超时后整棵树尽快返回，结果作废
+    bool timed;                         //按 budget 决定迭代加深到哪一轮为止
+    TimeBudget budget;
+    chrono::steady_clock::time_point searchStart;
+    const vector<PackedMove>* rootMoves;    //调用方已生成的根节点着法（引擎生成顺序），为空时自己生成
+    const atomic<bool>* cancel;         //调用方置位后搜索尽快返回，结果作废
+    uint64_t nodes;
+};
+
+template <int N>
+uint64_t hashPieces(const EnginePosition<N>& pos)
+{
+    uint64_t hash = 0;
+    const Piece pieces[3] = { WHITE_QUEEN, BLACK_QUEEN, ARROW };
+    const Bitboard<N> sets[3] = { pos.queens[0], pos.queens[1], pos.arrows };
+    for (int i = 0; i < 3; ++i)
+    {
+        Bitboard<N> bits = sets[i];
+        while (!isEmpty(bits))
+            hash ^= zobristKeys[popLsb(bits)][pieces[i]];
+    }
+    return hash;
+}
+
+template <int N>
+void initSearch(SearchContext<N>& ctx, const EnginePosition<N>& pos, const SearchOptions& options)
+{
+    ctx.pos = pos;
+    ctx.options = options;
+    ctx.moveStack.resize(options.depth + 1);
+    ctx.pv.resize(options.depth + 1);
+    ctx.network = options.nnue && nnueNetworks[N].loaded ? &nnueNetworks[N] : nullptr;
+    if (ctx.network)
+        nnueRefresh(*ctx.network, pos, ctx.accumulator);
+    ctx.table = nullptr;
+    ctx.hash = hashPieces(pos);
+    ctx.hasDeadline = false;
+    ctx.nextClockCheck = 0;
+    ctx.completedDepth = 0;
+    ctx.stopped = false;
+    ctx.timed = false;
+    ctx.rootMoves = nullptr;
+    ctx.cancel = nullptr;
+    ctx.nodes = 0;
+}
+
+//给搜索设时限；第一轮迭代总会搜完，保证有着法可走
+template <int N>
+void setSearchDeadline(SearchContext<N>& ctx, chrono::steady_clock::time_point deadline)
+{
+    ctx.hasDeadline = true;
+    ctx.deadline = deadline;
+}
+
+//按时钟分配的用时搜索，硬限作为时限；options.depth 应取 timedSearchOptions 的深度
+template <int N>
+void setTimeBudget(SearchContext<N>& ctx, const TimeBudget& budget)
+{
+    ctx.timed = true;
+    ctx.budget = budget;
+    ctx.searchStart = chrono::steady_clock::now();
+    setSearchDeadline(ctx, ctx.searchStart + chrono::milliseconds(budget.hardMs));
+}
+
+//每隔一批节点看一次时钟
+const uint64_t CLOCK_CHECK_NODES = 4096;
+
+template <int N>
+bool searchStopped(SearchContext<N>& ctx)
+{
+    if (!ctx.stopped && (ctx.hasDeadline || ctx.cancel) && ctx.nodes >= ctx.nextClockCheck)
+    {
+        ctx.nextClockCheck = ctx.nodes + CLOCK_CHECK_NODES;
+        if (ctx.cancel && *ctx.cancel)
+            ctx.stopped = true;
+        else if (ctx.hasDeadline && ctx.completedDepth > 0 && chrono::steady_clock::now() >= ctx.deadline)
+            ctx.stopped = true;
+    }
+    return ctx.stopped;
+}
+
+//行棋方不同的同一棋子布局是不同的局面
+template <int N>
+uint64_t positionKey(const SearchContext<N>& ctx, int side)
+{
+    return side == 1 ? ctx.hash ^ zobristBlackToMove : ctx.hash;
+}
+
+template <int N>
+void updateHash(SearchContext<N>& ctx, PackedMove move, int side)
+{
+    Piece player = side == 1 ? BLACK_QUEEN : WHITE_QUEEN;
+    ctx.hash ^= zobristKeys[moveFrom(move)][player] ^ zobristKeys[moveTo(move)][player] ^ zobristKeys[moveArrow(move)][ARROW];
+}
+
+//搜索中的走子：棋盘、哈希和 NNUE 累加器一起增量更新
+template <int N>
+void makeMove(SearchContext<N>& ctx, PackedMove move, int side)
+{
+    if (ctx.network)
+        nnueApplyMove(*ctx.network, ctx.accumulator, ctx.pos, move, side, false);
+    makeMove(ctx.pos, move, side);
+    updateHash(ctx, move, side);
+}
+
+template <int N>
+void undoMove(SearchContext<N>& ctx, PackedMove move, int side)
+{
+    undoMove(ctx.pos, move, side);
+    updateHash(ctx, move, side);
+    if (ctx.network)
+        nnueApplyMove(*ctx.network, ctx.accumulator, ctx.pos, move, side, true);
+}
+
+//叶节点评估，行棋方视角
+template <int N>
+int evaluateLeaf(const SearchContext<N>& ctx, int side)
+{
+    int eval = ctx.network ? nnueEvaluate(*ctx.network, ctx.accumulator) : evaluateBoard(ctx.pos);
+    return side == 1 ? eval : -eval;
+}
+
+//取分数最高的 limit 个，limit 为 0 时全部保留
+inline void keepBest(vector<pair<int, PackedMove>>& scored, int limit)
+{
+    if (limit <= 0 || scored.size() <= (size_t)limit)
+        return;
+    partial_sort(scored.begin(), scored.begin() + limit, scored.end(),
+        [](const pair<int, PackedMove>& a, const pair<int, PackedMove>& b) { return a.first > b.first; });
+    scored.resize(limit);
+}
+
+//前向剪枝的着法生成：先按落点周围空格数挑出 maxTargets 个落点，
+//每个落点再按“堵住对方皇后多少、堵住自己多少”挑出 maxArrows 个射箭格
+//每个落点至少能把箭射回起点，所以有落点就一定有着法，无路可走的判断不受剪枝影响
+template <int N>
+void getSelectiveMoves(SearchContext<N>& ctx, int side, vector<pair<int, PackedMove>>& moves)
+{
+    const EngineTables<N>& t = engineTables<N>();
+    const EnginePosition<N>& pos = ctx.pos;
+    Bitboard<N> occupied = occupiedOf(pos);
+    Bitboard<N> queens = pos.queens[side];
+    ctx.targets.clear();
+    while (!isEmpty(queens))
+    {
+        int from = popLsb(queens);
+        Bitboard<N> lifted = occupied ^ squareBit<Bitboard<N>>(from);
+        for (int d = 0; d < 8; ++d)
+        {
+            for (int i = 0; i < t.rayLength[from][d]; ++i)
+            {
+                int to = t.rays[from][d][i];
+                if (testBit(occupied, to))
+                    break;
+                ctx.targets.push_back({ popCount(t.neighbors[to] & ~lifted), (PackedMove)from | (PackedMove)to << 8 });
+            }
+        }
+    }
+    keepBest(ctx.targets, ctx.options.maxTargets);
+
+    moves.clear();
+    for (const auto& target : ctx.targets)
+    {
+        int from = moveFrom(target.second);
+        int to = moveTo(target.second);
+        Bitboard<N> lifted = occupied ^ squareBit<Bitboard<N>>(from);
+        Bitboard<N> own = pos.queens[side] ^ squareBit<Bitboard<N>>(from) ^ squareBit<Bitboard<N>>(to);
+        ctx.arrows.clear();
+        for (int ad = 0; ad < 8; ++ad)
+        {
+            for (int j = 0; j < t.rayLength[to][ad]; ++j)
+            {
+                int arrow = t.rays[to][ad][j];
+                if (testBit(lifted, arrow))
+                    break;
+                int blocked = popCount(t.neighbors[arrow] & pos.queens[1 - side]) - popCount(t.neighbors[arrow] & own);
+                ctx.arrows.push_back({ blocked, target.second | (PackedMove)arrow << 16 });
+            }
+        }
+        keepBest(ctx.arrows, ctx.options.maxArrows);
+        for (const auto& arrow : ctx.arrows)
+            moves.push_back({ target.first * 32 + arrow.first + 16, arrow.second });
+    }
+}
+
+//生成着法并按静态分数从高到低排序
+//前沿节点（子节点直接估值）排序的开销比它带来的剪枝还大，保持生成顺序
+template <int N>
+vector<pair<int, PackedMove>>& orderedMoves(SearchContext<N>& ctx, int side, int ply, bool sorted = true)
+{
+    vector<pair<int, PackedMove>>& ordered = ctx.moveStack[ply];
+    if (ctx.options.maxTargets > 0 || ctx.options.maxArrows > 0)
+        getSelectiveMoves(ctx, side, ordered);
+    else
+    {
+        if (ply == 0 && ctx.rootMoves)
+            ctx.generated = *ctx.rootMoves;
+        else
+            getAllValidMoves(ctx.pos, side, ctx.generated);
+        ordered.clear();
+        for (PackedMove move : ctx.generated)
+            ordered.push_back({ sorted ? scoreMove(ctx.pos, move) : 0, move });
+    }
+    if (sorted)
+        stable_sort(ordered.begin(), ordered.end(),
+            [](const pair<int, PackedMove>& a, const pair<int, PackedMove>& b) { return a.first > b.first; });
+    return ordered;
+}
+
+template <int N>
+int negamax(SearchContext<N>& ctx, int side, int depth, int alpha, int beta, int ply);
+
+//搜索排在第 index 位的着法：第一手用完整窗口，其余先用零窗口试探，超出 alpha 再完整重搜
+//排序靠后的着法先少搜 lmrReduction 层，试探结果超出 alpha 时恢复原深度
+template <int N>
+int searchChild(SearchContext<N>& ctx, int side, PackedMove move, size_t index, int depth,
+    int alpha, int beta, int ply)
+{
+    const SearchOptions& opt = ctx.options;
+    makeMove(ctx, move, side);
+    int score;
+    if (index == 0)
+        score = -negamax(ctx, 1 - side, depth - 1, -beta, -alpha, ply + 1);
+    else
+    {
+        int reduction = 0;
+        if (opt.lmrReduction > 0 && depth >= opt.lmrMinDepth && index >= (size_t)opt.lmrFullMoves)
+            reduction = min(opt.lmrReduction, depth - 1);
+        score = -negamax(ctx, 1 - side, depth - 1 - reduction, -alpha - 1, -alpha, ply + 1);
+        if (reduction > 0 && score > alpha)
+            score = -negamax(ctx, 1 - side, depth - 1, -alpha - 1, -alpha, ply + 1);
+        if (score > alpha && score < beta)
+            score = -negamax(ctx, 1 - side, depth - 1, -beta, -alpha, ply + 1);
+    }
+    undoMove(ctx, move, side);
+    return score;
+}
+
+//前沿节点（剩余一层）：子节点都直接估值，先把全部子局面写进 SoA 缓冲区，每 LEAF_BATCH_BLOCK 个一起评估，
+//再按生成顺序取最佳，遇到截断就不再评估后面的块；每个评估过的子局面计一个节点，结果与逐个 走子-评估-撤销 相同
+template <int N>
+int searchFrontier(SearchContext<N>& ctx, int side, int alpha, int beta, int ply)
+{
+    vector<pair<int, PackedMove>>& moves = orderedMoves(ctx, side, ply, false);
+    if (moves.empty())
+        return -INF_SCORE + ply;
+
+    const EnginePosition<N>& pos = ctx.pos;
+    LeafBatch& batch = ctx.batch;
+    size_t count = moves.size();
+    size_t padded = resizeLeafBatch(batch, count);
+    for (size_t i = 0; i < padded; ++i)
+    {
+        PackedMove move = moves[min(i, count - 1)].second;
+        batch.queens[side][i] = pos.queens[side] ^ squareBit<uint64_t>(moveFrom(move)) ^ squareBit<uint64_t>(moveTo(move));
+        batch.queens[1 - side][i] = pos.queens[1 - side];
+        batch.arrows[i] = pos.arrows | squareBit<uint64_t>(moveArrow(move));
+    }
+    int best = -INF_SCORE;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (i % LEAF_BATCH_BLOCK == 0)
+        {
+            size_t end = min(count, i + LEAF_BATCH_BLOCK);
+            evaluateLeafBatch(batch, i, end);
+            ctx.nodes += end - i;
+        }
+        int score = side == 1 ? batch.scores[i] : -batch.scores[i];
+        if (score > best)
+            best = score;
+        if (best > alpha)
+        {
+            alpha = best;
+            ctx.pv[ply].assign(1, moves[i].second);
+        }
+        if (alpha >= beta)
+            break;
+    }
+    return best;
+}
+
+//negamax + 主变例搜索，分数以行棋方视角计，无路可走时越早输越差
+//有置换表时：表中着法排到最前；零窗口节点遇到足够深、界合适的记录直接返回，主变例节点照常搜索以保留完整主变例
+template <int N>
+int negamax(SearchContext<N>& ctx, int side, int depth, int alpha, int beta, int ply)
+{
+    ctx.nodes++;
+    ctx.pv[ply].clear();
+    if (searchStopped(ctx))
+        return 0;
+    if (depth == 0)
+        return evaluateLeaf(ctx, side);
+    if constexpr (N == 8)
+    {
+        if (depth == 1 && !ctx.network)
+            return searchFrontier(ctx, side, alpha, beta, ply);
+    }
+
+    int originalAlpha = alpha;
+    uint64_t key = 0;
+    TtHit hit = { NO_PACKED_MOVE, 0, 0, TT_NONE };
+    if (ctx.table)
+    {
+        key = positionKey(ctx, side);
+        if (probeTransposition(*ctx.table, key, hit) && hit.depth >= depth && beta - alpha == 1)
+        {
+            int score = scoreFromTable(hit.score, ply);
+            if (hit.bound == TT_EXACT || (hit.bound == TT_LOWER && score >= beta) || (hit.bound == TT_UPPER && score <= alpha))
+                return score;
+        }
+    }
+
+    vector<pair<int, PackedMove>>& moves = orderedMoves(ctx, side, ply, depth > 1);
+    if (moves.empty())
+        return -INF_SCORE + ply;
+    if (hit.bound != TT_NONE)
+    {
+        auto found = find_if(moves.begin(), moves.end(),
+            [&](const pair<int, PackedMove>& m) { return m.second == hit.move; });
+        if (found != moves.end())
+            rotate(moves.begin(), found, found + 1);
+    }
+
+    int best = -INF_SCORE;
+    PackedMove bestMove = moves[0].second;
+    for (size_t i = 0; i < moves.size(); ++i)
+    {
+        PackedMove move = moves[i].second;
+        int score = searchChild(ctx, side, move, i, depth, alpha, beta, ply);
+        if (score > best)
+        {
+            best = score;
+            bestMove = move;
+        }
+        if (best > alpha)
+        {
+            alpha = best;
+            ctx.pv[ply].assign(1, move);
+            ctx.pv[ply].insert(ctx.pv[ply].end(), ctx.pv[ply + 1].begin(), ctx.pv[ply + 1].end());
+        }
+        if (alpha >= beta)
+            break;
+    }
+    if (ctx.table && !ctx.stopped)
+    {
+        int bound = best >= beta ? TT_LOWER : best > originalAlpha ? TT_EXACT : TT_UPPER;
+        storeTransposition(*ctx.table, key, bestMove, scoreToTable(best, ply), depth, bound);
+    }
+    return best;
+}
+
+//根节点：rootMoves 按上一轮结果排好序，最佳着法移到最前面供下一轮先搜
+template <int N>
+int searchRoot(SearchContext<N>& ctx, int side, int depth, int alpha, int beta,
+    vector<PackedMove>& rootMoves)
+{
+    int best = -INF_SCORE;
+    size_t bestIndex = 0;
+    for (size_t i = 0; i < rootMoves.size(); ++i)
+    {
+        int score = searchChild(ctx, side, rootMoves[i], i, depth, alpha, beta, 0);
+        if (score > best)
+        {
+            best = score;
+            bestIndex = i;
+        }
+        if (best > alpha)
+            alpha = best;
+        if (alpha >= beta)
+            break;
+    }
+    rotate(rootMoves.begin(), rootMoves.begin() + bestIndex, rootMoves.begin() + bestIndex + 1);
+    return best;
+}
+
+//渴望窗口：以上一轮分数为中心的窄窗口，落在窗口外则向失败一侧加倍放宽后重搜
+template <int N>
+int searchWithAspiration(SearchContext<N>& ctx, int side, int depth, int previous,
+    vector<PackedMove>& rootMoves)
+{
+    if (depth == 1)
+        return searchRoot(ctx, side, depth, -INF_SCORE, INF_SCORE, rootMoves);
+
+    int window = ASPIRATION_WINDOW;
+    int alpha = max(-INF_SCORE, previous - window);
+    int beta = min(INF_SCORE, previous + window);
+    while (true)
+    {
+        int score = searchRoot(ctx, side, depth, alpha, beta, rootMoves);
+        if (ctx.stopped)
+            return score;
+        if (score <= alpha && alpha > -INF_SCORE)
+            alpha = max(-INF_SCORE, alpha - window);
+        else if (score >= beta && beta < INF_SCORE)
+            beta = min(INF_SCORE, beta + window);
+        else
+            return score;
+        window *= 2;
+    }
+}
+
+//按棋盘大小选择引擎实例，f 收到 integral_constant<int, N>
+template <class F>
+auto withEngine(int size, F&& f)
+{
+    if (size == 10)
+        return f(integral_constant<int, 10>());
+    return f(integral_constant<int, 8>());
+}
+
+//排除搜索：去掉最佳着法，其余着法各以 score - DOMINANCE_MARGIN 为界做少一层的零窗口搜索（不缩减），
+//全部不超过这个界才算最佳着法明显领先；只有一手可走时也算领先
+//迭代中其余着法的分数来自缩减、剪枝后的零窗口试探，不能直接当作它们的上界
+template <int N>
+bool isBestMoveDominant(SearchContext<N>& ctx, int side, int depth, int score, const vector<PackedMove>& rootMoves)
+{
+    int bound = score - DOMINANCE_MARGIN;
+    int reduced = max(1, depth - 1);
+    for (size_t i = 1; i < rootMoves.size(); ++i)
+    {
+        makeMove(ctx, rootMoves[i], side);
+        int value = -negamax(ctx, 1 - side, reduced - 1, -bound, -bound + 1, 1);
+        undoMove(ctx, rootMoves[i], side);
+        if (ctx.stopped || value >= bound)
+            return false;
+    }
+    return true;
+}
+
+//计时搜索每搜完一轮决定是否再深一层：胜负已定就停；最佳着法刚变过就放宽软限；
+//用时已超过收紧后的软限、但还没到正常软限时，做一次排除搜索，确认明显领先就提前出着
+template <int N>
+bool shouldSearchDeeper(SearchContext<N>& ctx, int side, int depth, bool bestChanged, int score,
+    const vector<PackedMove>& rootMoves)
+{
+    if (abs(score) >= WIN_THRESHOLD)
+        return false;
+    double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - ctx.searchStart).count();
+    double share = ctx.budget.softMs * NEXT_ITERATION_SHARE;
+    if (bestChanged)
+        return elapsed < share * UNSTABLE_TIME_FACTOR;
+    if (elapsed >= share)
+        return false;
+    if (elapsed >= share * DOMINANT_TIME_FACTOR && isBestMoveDominant(ctx, side, depth, score, rootMoves))
+        return false;
+    return !ctx.stopped;
+}
+
+//迭代加深，每一轮用上一轮的分数设渴望窗口、用上一轮的最佳着法先搜
+//超时中断的一轮整轮作废，返回上一轮的结果；无路可走时返回 NO_PACKED_MOVE
+template <int N>
+PackedMove searchBestMove(SearchContext<N>& ctx, int side, int& score)
+{
+    vector<PackedMove> rootMoves;
+    for (const auto& entry : orderedMoves(ctx, side, 0))
+        rootMoves.push_back(entry.second);
+    score = 0;
+    if (rootMoves.empty())
+        return NO_PACKED_MOVE;
+
+    vector<PackedMove> completed;
+    for (int depth = 1; depth <= ctx.options.depth; ++depth)
+    {
+        completed = rootMoves;
+        int result = searchWithAspiration(ctx, side, depth, score, rootMoves);
+        if (ctx.stopped)
+        {
+            rootMoves.swap(completed);
+            break;
+        }
+        score = result;
+        ctx.completedDepth = depth;
+        if (ctx.timed && !shouldSearchDeeper(ctx, side, depth, depth > 1 && rootMoves[0] != completed[0], score, rootMoves))
+            break;
+    }
+    return rootMoves[0];
+}
+
+//budget 非空时按时钟分配的用时搜索；rootMoves 非空时为着法缓存里这个局面的全部着法；
+//cancel 置位后尽快返回，结果作废
+template <int N>
+Move findBestMoveFor(const Board& board, const TimeBudget* budget, const vector<PackedMove>* rootMoves,
+    const atomic<bool>* cancel)
+{
+    SearchContext<N> ctx;
+    initSearch(ctx, positionFromBoard<N>(board), budget ? timedSearchOptions(searchOptions) : searchOptions);
+    if (budget)
+        setTimeBudget(ctx, *budget);
+    ctx.rootMoves = rootMoves;
+    ctx.cancel = cancel;
+    int score;
+    PackedMove best = searchBestMove(ctx, sideIndex(BLACK_QUEEN), score);
+    if (best == NO_PACKED_MOVE)
+        return { {-1, -1}, {-1, -1}, {-1, -1} };
+
+    logDebug(string("AI 最佳移动评估分数: ") + to_string(score) + " 深度 " + to_string(ctx.completedDepth) +
+        " 节点 " + to_string(ctx.nodes) +
+        (budget ? " 软限 " + to_string(budget->softMs) + " ms 硬限 " + to_string(budget->hardMs) + " ms" : string()));
+    return unpackMove(best, N);
+}
+
+Move findBestMove(const Board& board, const TimeBudget* budget = nullptr, const vector<PackedMove>* rootMoves = nullptr,
+    const atomic<bool>* cancel = nullptr)
+{
+    Move bookMove;
+    if (probeOpeningBook(board, BLACK_QUEEN, bookMove))
+    {
+        logDebug("AI 使用开局库着法");
+        return bookMove;
+    }
+    return withEngine((int)board.size(), [&](auto n) { return findBestMoveFor<decltype(n)::value>(board, budget, rootMoves, cancel); });
+}
+
+//批量分析：任意一方走棋，输出前 multiPv 手的分数（行棋方视角）、深度和主变例
+struct AnalysisRequest
+{
+    Board board;
+    Piece player;
+};
+
+struct AnalysisLine
+{
+    Move move;
+    int score;
+    vector<Move> pv;
+};
+
+struct AnalysisResult
+{
+    int depth;
+    uint64_t nodes;
+    vector<AnalysisLine> lines;     //按分数从高到低，无路可走时为空
+};
+
+struct RootMove
+{
+    PackedMove move;
+    int score;
+    bool exact;                     //false 表示只知道分数不超过 score，不在前 multiPv 之内
+    vector<PackedMove> pv;
+};
+
+//前 multiPv 手用完整窗口取得准确分数，之后以当前第 multiPv 好的分数为 alpha 做零窗口试探，
+//只有超过它的着法才重搜准确分数并挤进前 multiPv；根节点着法不做后期缩减
+template <int N>
+void searchRootMultiPv(SearchContext<N>& ctx, int side, int depth, vector<RootMove>& roots, int multiPv)
+{
+    priority_queue<int, vector<int>, greater<int>> top;
+    for (RootMove& root : roots)
+    {
+        int alpha = (int)top.size() < multiPv ? -INF_SCORE : top.top();
+        makeMove(ctx, root.move, side);
+        root.score = alpha == -INF_SCORE ? alpha + 1 : -negamax(ctx, 1 - side, depth - 1, -alpha - 1, -alpha, 1);
+        if (root.score > alpha)
+            root.score = -negamax(ctx, 1 - side, depth - 1, -INF_SCORE, -alpha, 1);
+        undoMove(ctx, root.move, side);
+        root.exact = root.score > alpha;
+        root.pv.clear();
+        if (!root.exact)
+            continue;
+        root.pv.push_back(root.move);
+        root.pv.insert(root.pv.end(), ctx.pv[1].begin(), ctx.pv[1].end());
+        top.push(root.score);
+        if ((int)top.size() > multiPv)
+            top.pop();
+    }
+    stable_sort(roots.begin(), roots.end(), [](const RootMove& a, const RootMove& b)
+        {
+            return a.score != b.score ? a.score > b.score : a.exact && !b.exact;
+        });
+}
+
+template <int N>
+AnalysisResult analyzePositionFor(const Board& board, Piece player, int multiPv, const SearchOptions& options)
+{
+    SearchContext<N> ctx;
+    initSearch(ctx, positionFromBoard<N>(board), options);
+    int side = sideIndex(player);
+    vector<RootMove> roots;
+    for (const auto& entry : orderedMoves(ctx, side, 0))
+        roots.push_back({ entry.second, 0, false, {} });
+
+    AnalysisResult result = { 0, 0, {} };
+    if (roots.empty())
+        return result;
+    for (int depth = 1; depth <= options.depth; ++depth)
+        searchRootMultiPv(ctx, side, depth, roots, multiPv);
+
+    result.depth = options.depth;
+    result.nodes = ctx.nodes;
+    for (size_t i = 0; i < roots.size() && i < (size_t)multiPv && roots[i].exact; ++i)
+    {
+        AnalysisLine line = { unpackMove(roots[i].move, N), roots[i].score, {} };
+        for (PackedMove move : roots[i].pv)
+            line.pv.push_back(unpackMove(move, N));
+        result.lines.push_back(line);
+    }
+    return result;
+}
+
+AnalysisResult analyzePosition(const Board& board, Piece player, int multiPv, const SearchOptions& options)
+{
+    return withEngine((int)board.size(),
+        [&](auto n) { return analyzePositionFor<decltype(n)::value>(board, player, multiPv, options); });
+}
+
+//把 count 个任务分给 threads 个线程，空闲的线程领取下一个编号，耗时不均的局面也能摊平；
+//返回实际用的线程数（不超过任务数）
+int runParallelJobs(size_t count, int threads, const function<void(size_t, int)>& job)
+{
+    threads = max(1, min(threads, (int)max<size_t>(1, count)));
+    atomic<size_t> next(0);
+    vector<thread> workers;
+    for (int t = 0; t < threads; ++t)
+        workers.emplace_back([&next, &job, count, t]()
+            {
+                for (size_t i = next++; i < count; i = next++)
+                    job(i, t);
+            });
+    for (auto& w : workers)
+        w.join();
+    return threads;
+}
+
+//结果与 requests 一一对应；每个局面独立搜索，线程之间没有共享状态
+vector<AnalysisResult> analyzePositions(const vector<AnalysisRequest>& requests, int multiPv,
+    const SearchOptions& options, int threads)
+{
+    vector<AnalysisResult> results(requests.size());
+    runParallelJobs(requests.size(), threads, [&](size_t i, int)
+        {
+            results[i] = analyzePosition(requests[i].board, requests[i].player, multiPv, options);
+        });
+    return results;
+}
+
+//着法缓存：记住最近一个局面（按 Zobrist 哈希）的全部着法，界面高亮、点击验证和 AI 根节点共用，
+//同一局面只生成一次；按 起点、终点 查一张箭格表，点击验证只查表
+struct MoveCache
+{
+    uint64_t key;
+    int size;
+    vector<PackedMove> moves;       //引擎的生成顺序
+    vector<uint8_t> movable;        //[起点] 为 1 表示这个皇后能走
+    vector<int> pairSlots;          //[起点 * 格数 + 终点] -> 箭格表编号，-1 表示走不到
+    vector<uint8_t> arrows;         //[编号 * 格数 + 箭格] 为 1 表示可以射箭
+};
+
+MoveCache moveCache;    //size 为 0 表示还没有缓存
+
+const MoveCache& cachedMoves(const Board& board, Piece player)
+{
+    int size = (int)board.size();
+    uint64_t key = hashBoard(board, player);
+    if (moveCache.size == size && moveCache.key == key)
+        return moveCache;
+
+    moveCache.key = key;
+    moveCache.size = size;
+    withEngine(size, [&](auto n)
+        {
+            constexpr int N = decltype(n)::value;
+            getAllValidMoves(positionFromBoard<N>(board), sideIndex(player), moveCache.moves);
+        });
+    int cells = size * size;
+    moveCache.movable.assign(cells, 0);
+    moveCache.pairSlots.assign(cells * cells, -1);
+    moveCache.arrows.clear();
+    for (PackedMove move : moveCache.moves)
+    {
+        moveCache.movable[moveFrom(move)] = 1;
+        int& slot = moveCache.pairSlots[moveFrom(move) * cells + moveTo(move)];
+        if (slot < 0)
+        {
+            slot = (int)(moveCache.arrows.size() / cells);
+            moveCache.arrows.resize(moveCache.arrows.size() + cells, 0);
+        }
+        moveCache.arrows[slot * cells + moveArrow(move)] = 1;
+    }
+    return moveCache;
+}
+
+int cachedCell(const MoveCache& cache, const Position& p)
+{
+    return p.row * cache.size + p.col;
+}
+
+bool canQueenMove(const MoveCache& cache, const Position& from)
+{
+    return cache.movable[cachedCell(cache, from)] != 0;
+}
+
+bool isCachedTarget(const MoveCache& cache, const Position& from, const Position& to)
+{
+    return cache.pairSlots[cachedCell(cache, from) * cache.size * cache.size + cachedCell(cache, to)] >= 0;
+}
+
+bool isCachedMove(const MoveCache& cache, const Move& move)
+{
+    int cells = cache.size * cache.size;
+    int slot = cache.pairSlots[cachedCell(cache, move.queen_start) * cells + cachedCell(cache, move.queen_end)];
+    return slot >= 0 && cache.arrows[slot * cells + cachedCell(cache, move.arrow_pos)] != 0;
+}
+
+//游戏流程
+enum GamePhase
+{
+    PHASE_TURN_START,
+    PHASE_SELECT_QUEEN,
+    PHASE_SELECT_TARGET,
+    PHASE_SELECT_ARROW,
+    PHASE_ANIMATING,
+    PHASE_AI_THINKING,
+    PHASE_GAME_OVER
+};
+
+//AI 在后台线程搜索，主循环每帧检查是否完成；线程只读写自己的 AiJob，由 stopAiJob 取消并回收
+struct AiJob
+{
+    Board board;
+    bool timed;
+    TimeBudget budget;
+    vector<PackedMove> rootMoves;
+    Move result;
+    double seconds;
+    atomic<bool> done{ false };
+    atomic<bool> cancel{ false };
+    thread worker;
+};
+
+struct GameState
+{
+    Board board;
+    Piece currentPlayer;
+    GameRecord record;
+    GamePhase phase;
+    Move pending;
+    shared_ptr<AiJob> aiJob;
+    int64_t aiClockMs;      //AI 时钟剩余时间，gameClock 不计时时不用
+    bool quit;
+};
+
+//新游戏、读盘、悔棋和退出时 AI 的结果已经没用，让搜索尽快返回并等线程结束
+void stopAiJob(GameState& game)
+{
+    if (!game.aiJob)
+        return;
+    game.aiJob->cancel = true;
+    if (game.aiJob->worker.joinable())
+        game.aiJob->worker.join();
+    game.aiJob.reset();
+}
+
+void restartTurn(GameState& game)
+{
+    cancelFrameTasks();
+    game.phase = PHASE_TURN_START;
+    stopAiJob(game);
+    invalidateBoardView();
+}
+
+void startAiTurn(GameState& game)
+{
+    game.phase = PHASE_AI_THINKING;
+    drawSideText(6, _T("AI正在思考..."));
+
+    auto job = make_shared<AiJob>();
+    job->board = game.board;
+    job->timed = gameClock.totalMs > 0;
+    if (job->timed)
+        job->budget = allocateMoveTime(game.aiClockMs, gameClock.incrementMs, countEmptySquares(game.board));
+    job->rootMoves = cachedMoves(game.board, game.currentPlayer).moves;
+    game.aiJob = job;
+    AiJob* raw = job.get();
+    job->worker = thread([raw]()
+        {
+            auto start = chrono::high_resolution_clock::now();
+            raw->result = findBestMove(raw->board, raw->timed ? &raw->budget : nullptr, &raw->rootMoves, &raw->cancel);
+            auto end = chrono::high_resolution_clock::now();
+            chrono::duration<double> duration = end - start;
+            raw->seconds = duration.count();
+            raw->done = true;
+        });
+}
+
+void startMoveAnimation(GameState& game, const Move& move)
+{
+    Piece player = game.currentPlayer;
+    game.phase = PHASE_ANIMATING;
+    animateMove(move.queen_start, move.queen_end, player, [&game, move, player]()
+        {
+            makeMove(game.board, move, player);
+            recordMove(game.record, move);
+            game.currentPlayer = (player == WHITE_QUEEN) ? BLACK_QUEEN : WHITE_QUEEN;
+            game.phase = PHASE_TURN_START;
+        });
+}
+
+void drawGameOverText(const TCHAR* win_text, const TCHAR* reason_text)
+{
+    settextcolor(RED);
+    settextstyle(30, 0, _T("宋体"));
+    outtextxy(BOARD_PADDING, windowSize / 2 - 30, (TCHAR*)win_text);
+    settextstyle(20, 0, _T("宋体"));
+    outtextxy(BOARD_PADDING, windowSize / 2 + 10, (TCHAR*)reason_text);
+    markDirty(0, 0, windowSize, windowSize);
+
+    //特效播完后再提示结束，期间按钮照常响应
+    scheduleTask(1600 + 3000, nullptr, []()
+        {
+            drawSideText(7, _T("游戏结束"));
+        });
+}
+
+void startGameOver(GameState& game)
+{
+    game.phase = PHASE_GAME_OVER;
+    Piece winner_piece = (game.currentPlayer == WHITE_QUEEN) ? BLACK_QUEEN : WHITE_QUEEN;
+    wchar_t winner = (winner_piece == WHITE_QUEEN) ? L'B' : L'W';
+    TCHAR win_text[100];
+    _stprintf_s(win_text, _T("玩家 %c 获胜！"), winner);
+    TCHAR reason_text[100];
+    _stprintf_s(reason_text, _T("玩家 %c 无路可走"),
+        (game.currentPlayer == WHITE_QUEEN) ? L'W' : L'B');
+    drawGameOverText(win_text, reason_text);
+
+    if (winner == L'B')
+    {
+        //showFireworks();
+        showBlinkText(L"恭喜黑方获胜！", BOARD_PADDING, windowSize / 2 + 50);
+    }
+    else
+    {
+        //showFireworks();
+        showBlinkText(L"AI获胜！", BOARD_PADDING, windowSize / 2 + 50);
+    }
+}
+
+void updateGame(GameState& game)
+{
+    if (game.phase == PHASE_TURN_START)
+    {
+        //先让棋盘画面就绪，之后叠加的提示文字不会被整屏重绘清掉
+        renderBoard(game.board);
+        if (checkGameOver(game.board, game.currentPlayer))
+            startGameOver(game);
+        else if (game.currentPlayer == WHITE_QUEEN)
+            game.phase = PHASE_SELECT_QUEEN;
+        else
+            startAiTurn(game);
+    }
+    else if (game.phase == PHASE_AI_THINKING && game.aiJob && game.aiJob->done)
+    {
+        shared_ptr<AiJob> job = game.aiJob;
+        job->worker.join();
+        game.aiJob.reset();
+        logDebug(string("AI 思考时间: ") + to_string(job->seconds) + " 秒");
+        //时钟按走完这步的用时扣除，扣成负数即超时判负，这步不再落子；悔棋不退还用时
+        bool flagged = false;
+        if (job->timed)
+        {
+            game.aiClockMs -= (int64_t)(job->seconds * 1000);
+            flagged = game.aiClockMs < 0;
+            if (!flagged)
+                game.aiClockMs += gameClock.incrementMs;
+            logDebug(string("AI 时钟剩余: ") + to_string(game.aiClockMs) + " 毫秒" + (flagged ? "（超时）" : ""));
+        }
+        drawSideText(6, _T(""));
+
+        if (flagged)
+        {
+            game.phase = PHASE_GAME_OVER;
+            drawGameOverText(_T("玩家 B 获胜！"), _T("AI 超时"));
+            showBlinkText(L"恭喜玩家 B 获胜！", BOARD_PADDING, windowSize / 2 + 50);
+        }
+        else if (job->result.queen_start.row != -1)
+            startMoveAnimation(game, job->result);
+        else
+        {
+            game.phase = PHASE_GAME_OVER;
+            drawGameOverText(_T("玩家 B 获胜！"), _T("AI 无路可走"));
+            showFireworks();
+            showBlinkText(L"恭喜玩家 B 获胜！", BOARD_PADDING, windowSize / 2 + 50);
+        }
+    }
+}
+
+void handleButton(GameState& game, int btnIdx)
+{
+    if (btnIdx == 0)
+        saveGame(game.record);
+    else if (btnIdx == 1)
+    {
+        if (loadGame(game.record, game.board, game.currentPlayer))
+        {
+            if (boardSize != windowBoardSize)
+                openGameWindow();
+            //存档不记录时钟，读盘后 AI 按一盘新棋的时间重新计时
+            game.aiClockMs = gameClock.totalMs;
+            restartTurn(game);
+        }
+    }
+    else if (btnIdx == 2)
+    {
+        game.board = initializeBoard();
+        game.currentPlayer = WHITE_QUEEN;
+        resetRecord(game.record, game.board, game.currentPlayer);
+        game.aiClockMs = gameClock.totalMs;
+        restartTurn(game);
+    }
+    else if (btnIdx == 3)
+    {
+        //对局中第一次点击结束对局，结束后再次点击退出程序
+        if (game.phase == PHASE_GAME_OVER)
+            game.quit = true;
+        else
+        {
+            cancelFrameTasks();
+            stopAiJob(game);
+            game.phase = PHASE_GAME_OVER;
+            drawSideText(6, _T(""));
+            drawSideText(7, _T("游戏结束"));
+        }
+    }
+    else if (btnIdx == 4 || btnIdx == 5)
+    {
+        //悔棋/重做以人类回合为单位，连同 AI 的应着一起撤销或恢复
+        bool changed = false;
+        Piece human = WHITE_QUEEN;
+        if (btnIdx == 4)
+        {
+            while (undoRecordedMove(game.record, game.board, game.currentPlayer))
+            {
+                changed = true;
+                if (game.currentPlayer == human)
+                    break;
+            }
+        }
+        else
+        {
+            while (redoRecordedMove(game.record, game.board, game.currentPlayer))
+            {
+                changed = true;
+                if (game.currentPlayer == human)
+                    break;
+            }
+        }
+        if (changed)
+            restartTurn(game);
+        else
+            showTempMessage(btnIdx == 4 ? L"没有可以悔的棋！" : L"没有可以重做的棋！");
+    }
+}
+
+void handleBoardClick(GameState& game, const Position& p)
+{
+    if (game.phase == PHASE_SELECT_QUEEN)
+    {
+        if (game.board[p.row][p.col] == game.currentPlayer)
+        {
+            if (canQueenMove(cachedMoves(game.board, game.currentPlayer), p))
+            {
+                game.pending.queen_start = p;
+                game.phase = PHASE_SELECT_TARGET;
+            }
+            else
+                showTempMessage(L"该皇后无移动空间，请选择其他皇后！");
+        }
+        else
+            showTempMessage(L"请选择您的皇后！");
+    }
+    else if (game.phase == PHASE_SELECT_TARGET)
+    {
+        if (isCachedTarget(cachedMoves(game.board, game.currentPlayer), game.pending.queen_start, p))
+        {
+            game.pending.queen_end = p;
+            game.phase = PHASE_SELECT_ARROW;
+        }
+        else
+            showTempMessage(L"目标位置不合法！");
+    }
+    else if (game.phase == PHASE_SELECT_ARROW)
+    {
+        game.pending.arrow_pos = p;
+        if (isCachedMove(cachedMoves(game.board, game.currentPlayer), game.pending))
+            startMoveAnimation(game, game.pending);
+        else
+        {
+            showTempMessage(L"射箭位置不合法！");
+            game.phase = PHASE_SELECT_QUEEN;
+        }
+    }
+    else if (game.phase == PHASE_AI_THINKING)
+        showTempMessage(L"AI正在思考，请稍候");
+}
+
+void handleClick(GameState& game, const MOUSEMSG& m)
+{
+    int btnIdx = getButtonClick(m);
+    if (btnIdx != -1)
+    {
+        handleButton(game, btnIdx);
+        return;
+    }
+    Position p = screenToCell(m.x, m.y);
+    if (p.row != -1)
+        handleBoardClick(game, p);
+}
+
+void renderGame(const GameState& game)
+{
+    vector<Highlight> highlights;
+    if (game.phase == PHASE_SELECT_TARGET || game.phase == PHASE_SELECT_ARROW)
+    {
+        const MoveCache& cache = cachedMoves(game.board, game.currentPlayer);
+        int size = (int)game.board.size();
+        for (int r = 0; r < size; ++r)
+        {
+            for (int c = 0; c < size; ++c)
+            {
+                Position cell = { r, c };
+                if (game.phase == PHASE_SELECT_TARGET && isCachedTarget(cache, game.pending.queen_start, cell))
+                    highlights.push_back({ cell, RGB(196, 168, 143) });
+                else if (game.phase == PHASE_SELECT_ARROW &&
+                    isCachedMove(cache, { game.pending.queen_start, game.pending.queen_end, cell }))
+                    highlights.push_back({ cell, RGB(138, 51, 36) });
+            }
+        }
+    }
+    renderBoard(game.board, highlights);
+
+    if (game.phase == PHASE_SELECT_TARGET)
+        drawStatusText(_T("2/3: 请点击皇后目标"));
+    else if (game.phase == PHASE_SELECT_ARROW)
+        drawStatusText(_T("3/3: 请点击射箭目标"));
+    else
+        drawStatusText(_T("请在棋盘窗口操作按钮或走棋"));
+}
+
+//命令行工具
+string formatMove(const Move& move)
+{
+    return "(" + to_string(move.queen_start.row) + "," + to_string(move.queen_start.col) + ")->(" +
+        to_string(move.queen_end.row) + "," + to_string(move.queen_end.col) + ") 箭(" +
+        to_string(move.arrow_pos.row) + "," + to_string(move.arrow_pos.col) + ")";
+}
+
+bool loadRecordFile(const string& path, GameRecord& record)
+{
+    vector<uint8_t> bytes;
+    Board board;
+    Piece player;
+    if (!readFileBytes(path, bytes) || !decodeRecord(bytes.data(), bytes.size(), record, board, player))
+    {
+        cerr << "错误：无法读取棋谱 " << path << endl;
+        return false;
+    }
+    return true;
+}
+
+// --build-db <棋谱库> <棋谱文件...>
+int runBuildDatabase(int argc, char* argv[])
+{
+    if (argc < 4)
+    {
+        cerr << "用法：--build-db <棋谱库> <棋谱文件...>" << endl;
+        return 1;
+    }
+    vector<GameRecord> records;
+    for (int i = 3; i < argc; ++i)
+    {
+        GameRecord record;
+        if (loadRecordFile(argv[i], record))
+            records.push_back(record);
+    }
+    if (!appendGamesToDatabase(argv[2], records))
+        return 1;
+    cout << "已追加 " << records.size() << " 局到 " << argv[2] << endl;
+    return 0;
+}
+
+// --db-stats <棋谱库> [线程数]
+int runDatabaseStats(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        cerr << "用法：--db-stats <棋谱库> [线程数]" << endl;
+        return 1;
+    }
+    GameDatabase db;
+    if (!openGameDatabase(db, argv[2]))
+        return 1;
+    int threads = argc > 3 ? atoi(argv[3]) : (int)max(1u, thread::hardware_concurrency());
+
+    vector<uint64_t> positions(threads, 0);
+    auto start = chrono::high_resolution_clock::now();
+    parallelScanGameDatabase(db, threads, [&positions](const ScannedPosition& pos)
+        {
+            positions[pos.worker]++;
+        });
+    chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - start;
+    uint64_t total = 0;
+    for (uint64_t n : positions)
+        total += n;
+
+    uint32_t black_wins = 0, white_wins = 0;
+    for (uint32_t g = 0; g < db.header->game_count; ++g)
+    {
+        if (db.games[g].winner == BLACK_QUEEN)
+            black_wins++;
+        else if (db.games[g].winner == WHITE_QUEEN)
+            white_wins++;
+    }
+    cout << "对局数: " << db.header->game_count << "  局面数: " << total
+        << "  黑胜: " << black_wins << "  白胜: " << white_wins << endl;
+    cout << "扫描用时: " << elapsed.count() << " 秒 (" << threads << " 线程, "
+        << (uint64_t)(total / max(elapsed.count(), 1e-9)) << " 局面/秒)" << endl;
+
+    //开局统计：初始局面之后各着法的出现次数与行棋方胜率
+    struct MoveStat
+    {
+        PackedMove move;
+        uint32_t count, wins;
+    };
+    vector<MoveStat> stats;
+    Board start_board = initializeBoard();
+    auto range = findPosition(db, hashBoard(start_board, WHITE_QUEEN));
+    for (const DbIndexEntry* e = range.first; e != range.second; ++e)
+    {
+        PackedMove next = dbMoveAt(db, e->game, e->ply);
+        if (next == NO_PACKED_MOVE)
+            continue;
+        auto it = find_if(stats.begin(), stats.end(), [next](const MoveStat& m) { return m.move == next; });
+        if (it == stats.end())
+            it = stats.insert(stats.end(), { next, 0, 0 });
+        it->count++;
+        if (db.games[e->game].winner == WHITE_QUEEN)
+            it->wins++;
+    }
+    sort(stats.begin(), stats.end(), [](const MoveStat& a, const MoveStat& b) { return a.count > b.count; });
+    for (size_t i = 0; i < stats.size() && i < 10; ++i)
+        cout << formatMove(unpackMove(stats[i].move)) << "  " << stats[i].count << " 局, 胜率 "
+            << 100.0 * stats[i].wins / stats[i].count << "%" << endl;
+
+    closeGameDatabase(db);
+    return 0;
+}
+
+//开局库生成：离线搜索，每个局面取分数接近最优的前几手并继续展开
+const int BOOK_SEARCH_WIDTH = 3;
+const int BOOK_SCORE_MARGIN = 4 * EVAL_SCALE;
+
+//用批量分析的多 PV 搜索给前 BOOK_SEARCH_WIDTH 手打准确分数（行棋方视角），其余着法只做零窗口试探，
+//分数与 --analyze 的输出可以直接比较
+void expandBookFromSearch(const Board& board, Piece player, int plies, const SearchOptions& options,
+    map<pair<uint64_t, PackedMove>, uint32_t>& weights, set<uint64_t>& visited)
+{
+    if (plies == 0)
+        return;
+    uint64_t hash = hashBoard(board, player);
+    if (!visited.insert(hash).second)
+        return;
+    AnalysisResult analysis = analyzePosition(board, player, BOOK_SEARCH_WIDTH, options);
+    cout << "开局库: 已搜索 " << visited.size() << " 个局面" << endl;
+    for (const AnalysisLine& line : analysis.lines)
+    {
+        int gap = analysis.lines[0].score - line.score;
+        if (gap > BOOK_SCORE_MARGIN)
+            break;
+        weights[{ hash, packMove(line.move) }] =
+            100 * (BOOK_SCORE_MARGIN - gap + 1) / (BOOK_SCORE_MARGIN + 1);
+        Board child = board;
+        makeMove(child, line.move, player, false);
+        expandBookFromSearch(child, opponentOf(player), plies - 1, options, weights, visited);
+    }
+}
+
+//从棋谱库统计前若干步的着法频率，胜方的着法计双倍权重
+void collectBookFromDatabase(const GameDatabase& db, int plies, map<pair<uint64_t, PackedMove>, uint32_t>& weights)
+{
+    int threads = (int)max(1u, thread::hardware_concurrency());
+    vector<map<pair<uint64_t, PackedMove>, uint32_t>> partial(threads);
+    parallelScanGameDatabase(db, threads, [&partial, plies](const ScannedPosition& pos)
+        {
+            if (pos.ply >= (uint32_t)plies || pos.next_move == NO_PACKED_MOVE)
+                return;
+            partial[pos.worker][{ pos.hash, pos.next_move }] += (pos.winner == pos.side_to_move) ? 2 : 1;
+        });
+    for (const auto& part : partial)
+        for (const auto& kv : part)
+            weights[kv.first] += kv.second;
+}
+
+// --build-book <开局库> [步数] [棋谱库]
+int runBuildBook(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        cerr << "用法：--build-book <开局库> [步数] [棋谱库]" << endl;
+        return 1;
+    }
+    int plies = argc > 3 ? atoi(argv[3]) : 3;
+    map<pair<uint64_t, PackedMove>, uint32_t> weights;
+    if (argc > 4)
+    {
+        GameDatabase db;
+        if (!openGameDatabase(db, argv[4]))
+            return 1;
+        collectBookFromDatabase(db, plies, weights);
+        closeGameDatabase(db);
+    }
+    else
+    {
+        set<uint64_t> visited;
+        expandBookFromSearch(initializeBoard(), WHITE_QUEEN, plies, searchOptions, weights, visited);
+    }
+    if (!writeOpeningBook(argv[2], weights))
+        return 1;
+    cout << "开局库已写入 " << argv[2] << "，共 " << weights.size() << " 条" << endl;
+    return 0;
+}
+
+//自对弈强度测试：两组搜索参数轮流执白，每两局共用同一个随机开局
+const int SELFPLAY_RANDOM_PLIES = 2;
+
+struct SelfPlayStats
+{
+    int wins;
+    int moves;
+    double seconds;
+    uint64_t nodes;
+    int flags;          //计时对局中超时判负的局数
+};
+
+//configs/stats 下标 0 为参数 A，1 为参数 B；返回获胜方的参数下标
+//设置了 --clock 时双方各有一个时钟，走完一步时钟为负即超时判负
+template <int N>
+int playSelfPlayGame(const SearchOptions configs[2], int aSide, uint32_t openingSeed, SelfPlayStats stats[2])
+{
+    EnginePosition<N> pos = positionFromBoard<N>(initializeBoard(N));
+    int side = sideIndex(WHITE_QUEEN);
+    mt19937 rng(openingSeed);
+    vector<PackedMove> moves;
+    for (int ply = 0; ply < SELFPLAY_RANDOM_PLIES; ++ply)
+    {
+        getAllValidMoves(pos, side, moves);
+        if (moves.empty())
+            return side == aSide ? 1 : 0;
+        PackedMove move = moves[rng() % moves.size()];
+        makeMove(pos, move, side);
+        side = 1 - side;
+    }
+
+    SearchContext<N> ctx;
+    bool timed = gameClock.totalMs > 0;
+    int64_t clocks[2] = { gameClock.totalMs, gameClock.totalMs };
+    while (true)
+    {
+        int player = side == aSide ? 0 : 1;
+        initSearch(ctx, pos, timed ? timedSearchOptions(configs[player]) : configs[player]);
+        if (timed)
+            setTimeBudget(ctx, allocateMoveTime(clocks[player], gameClock.incrementMs, N * N - popCount(occupiedOf(pos))));
+        auto start = chrono::steady_clock::now();
+        int score;
+        PackedMove move = searchBestMove(ctx, side, score);
+        auto elapsed = chrono::steady_clock::now() - start;
+        stats[player].seconds += chrono::duration<double>(elapsed).count();
+        stats[player].nodes += ctx.nodes;
+        if (move == NO_PACKED_MOVE)
+            return 1 - player;
+        if (timed)
+        {
+            clocks[player] -= chrono::duration_cast<chrono::milliseconds>(elapsed).count();
+            if (clocks[player] < 0)
+            {
+                stats[player].flags++;
+                return 1 - player;
+            }
+            clocks[player] += gameClock.incrementMs;
+        }
+        stats[player].moves++;
+        makeMove(pos, move, side);
+        side = 1 - side;
+    }
+}
+
+// --selfplay [局数] [参数A] [参数B]，A 默认为当前搜索参数，B 默认为全宽搜索
+int runSelfPlay(int argc, char* argv[])
+{
+    int games = argc > 2 ? atoi(argv[2]) : 10;
+    SearchOptions configs[2] = { searchOptions, FULL_WIDTH_SEARCH };
+    if (games <= 0 || (argc > 3 && !parseSearchOptions(argv[3], configs[0])) ||
+        (argc > 4 && !parseSearchOptions(argv[4], configs[1])))
+    {
+        cerr << "用法：--selfplay [局数] [参数A] [参数B]" << endl;
+        return 1;
+    }
+    cout << "A: " << describeSearchOptions(configs[0]) << endl;
+    cout << "B: " << describeSearchOptions(configs[1]) << endl;
+    if (gameClock.totalMs > 0)
+        cout << "计时：每方 " << gameClock.totalMs << " ms，每步加 " << gameClock.incrementMs << " ms，深度只受时间限制" << endl;
+
+    SelfPlayStats stats[2] = {};
+    for (int game = 0; game < games; ++game)
+    {
+        int aSide = game % 2 == 0 ? sideIndex(WHITE_QUEEN) : sideIndex(BLACK_QUEEN);
+        int winner = withEngine(boardSize,
+            [&](auto n) { return playSelfPlayGame<decltype(n)::value>(configs, aSide, game / 2, stats); });
+        stats[winner].wins++;
+        cout << "第 " << game + 1 << " 局：A 执" << (aSide == sideIndex(WHITE_QUEEN) ? "白" : "黑")
+            << "，" << (winner == 0 ? "A" : "B") << " 胜" << endl;
+    }
+
+    for (int player = 0; player < 2; ++player)
+    {
+        const SelfPlayStats& s = stats[player];
+        int moves = max(1, s.moves);
+        cout << (player == 0 ? "A" : "B") << "：胜 " << s.wins << " 局，平均每步 "
+            << (int)(s.seconds * 1000 / moves) << " ms，" << s.nodes / moves << " 节点";
+        if (gameClock.totalMs > 0)
+            cout << "，超时 " << s.flags << " 局";
+        cout << endl;
+    }
+    cout << "A 得分率 " << 100 * stats[0].wins / games << "%" << endl;
+    return 0;
+}
+
+// --analyze <棋谱库> [多PV数] [线程数] [最多局面数]：批量分析棋谱库里每一个未终局的局面
+int runAnalyze(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        cerr << "用法：--analyze <棋谱库> [多PV数] [线程数] [最多局面数]" << endl;
+        return 1;
+    }
+    int multiPv = argc > 3 ? max(1, atoi(argv[3])) : 3;
+    int threads = argc > 4 ? atoi(argv[4]) : (int)max(1u, thread::hardware_concurrency());
+    size_t limit = argc > 5 ? (size_t)max(1, atoi(argv[5])) : numeric_limits<size_t>::max();
+
+    GameDatabase db;
+    if (!openGameDatabase(db, argv[2]))
+        return 1;
+
+    //局面不预先解码：每个线程领取一局，直接从映射的着法流复现并逐个分析，内存只随线程数增长；
+    //一局分析完整块输出，各局之间的顺序取决于完成先后
+    atomic<size_t> claimed(0);
+    atomic<uint64_t> analyzed(0), nodes(0);
+    mutex output;
+    auto start = chrono::steady_clock::now();
+    int used = runParallelJobs(db.header->game_count, threads, [&](size_t game, int worker)
+        {
+            ostringstream text;
+            scanGameDatabase(db, (uint32_t)game, (uint32_t)game + 1, [&](const ScannedPosition& pos)
+                {
+                    if (pos.next_move == NO_PACKED_MOVE || claimed++ >= limit)
+                        return;
+                    AnalysisResult result = analyzePosition(*pos.board, pos.side_to_move, multiPv, searchOptions);
+                    analyzed++;
+                    nodes += result.nodes;
+                    text << "对局 " << pos.game << " 第 " << pos.ply + 1 << " 手（"
+                        << (pos.side_to_move == BLACK_QUEEN ? "黑" : "白") << "方走） 深度 " << result.depth << "\n";
+                    for (size_t k = 0; k < result.lines.size(); ++k)
+                    {
+                        text << "  " << k + 1 << ". " << result.lines[k].score << "  ";
+                        for (const Move& move : result.lines[k].pv)
+                            text << formatMove(move) << "  ";
+                        text << "\n";
+                    }
+                }, worker);
+            lock_guard<mutex> guard(output);
+            cout << text.str() << flush;
+        });
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    closeGameDatabase(db);
+
+    double seconds = max(elapsed.count(), 1e-9);
+    cout << "共分析 " << analyzed << " 个局面，" << used << " 个线程，用时 " << elapsed.count()
+        << " 秒，每秒 " << analyzed / seconds << " 个局面，"
+        << (uint64_t)(nodes / seconds) << " 个节点" << endl;
+    return 0;
+}
+
+//调参数据集：自对弈每个局面的棋子位置和最终胜负，便于评估项改动后重新提取特征
+//  TuneHeader
+//  TuneSample × 局面数
+#pragma pack(push, 1)
+struct TuneHeader
+{
+    char magic[4];
+    uint16_t version;
+    uint8_t board_size;
+    uint8_t reserved0;
+    uint32_t sample_count;
+    uint32_t reserved1;
+};
+
+struct TuneSample
+{
+    uint8_t queens[2][4];   //[0] 白后 [1] 黑后，格子编号 row * 棋盘大小 + col
+    uint64_t arrows[2];     //障碍位图的低 64 位和高 64 位
+    uint8_t side_to_move;   //0 白方 1 黑方
+    uint8_t black_won;
+    uint16_t ply;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(TuneHeader) == 16 && sizeof(TuneSample) == 28, "调参数据集记录布局不能改变");
+
+const char TUNE_MAGIC[4] = { 'A', 'M', 'T', 'D' };
+const uint16_t TUNE_VERSION = 1;
+const int TUNE_RANDOM_PLIES = 6;
+
+inline void storeBitboard(uint64_t b, uint64_t words[2]) { words[0] = b; words[1] = 0; }
+inline void storeBitboard(Bits128 b, uint64_t words[2]) { words[0] = b.lo; words[1] = b.hi; }
+inline void loadBitboard(uint64_t& b, const uint64_t words[2]) { b = words[0]; }
+inline void loadBitboard(Bits128& b, const uint64_t words[2]) { b = { words[0], words[1] }; }
+
+template <int N>
+TuneSample sampleFromPosition(const EnginePosition<N>& pos, int side, int ply)
+{
+    TuneSample sample = {};
+    for (int s = 0; s < 2; ++s)
+    {
+        Bitboard<N> queens = pos.queens[s];
+        for (int i = 0; i < 4 && !isEmpty(queens); ++i)
+            sample.queens[s][i] = (uint8_t)popLsb(queens);
+    }
+    storeBitboard(pos.arrows, sample.arrows);
+    sample.side_to_move = (uint8_t)side;
+    sample.ply = (uint16_t)ply;
+    return sample;
+}
+
+template <int N>
+EnginePosition<N> positionFromSample(const TuneSample& sample)
+{
+    EnginePosition<N> pos = {};
+    for (int s = 0; s < 2; ++s)
+        for (int i = 0; i < 4; ++i)
+            pos.queens[s] |= squareBit<Bitboard<N>>(sample.queens[s][i]);
+    loadBitboard(pos.arrows, sample.arrows);
+    return pos;
+}
+
+//开局随机走几步，之后双方都用 options 搜索，记录随机段之后的每个局面（含终局）
+template <int N>
+void playTuneGame(const SearchOptions& options, uint32_t seed, vector<TuneSample>& samples)
+{
+    EnginePosition<N> pos = positionFromBoard<N>(initializeBoard(N));
+    int side = sideIndex(WHITE_QUEEN);
+    mt19937 rng(seed);
+    vector<PackedMove> moves;
+    int ply = 0;
+    for (; ply < TUNE_RANDOM_PLIES; ++ply)
+    {
+        getAllValidMoves(pos, side, moves);
+        if (moves.empty())
+            break;
+        PackedMove move = moves[rng() % moves.size()];
+        makeMove(pos, move, side);
+        side = 1 - side;
+    }
+
+    size_t first = samples.size();
+    SearchContext<N> ctx;
+    while (true)
+    {
+        samples.push_back(sampleFromPosition(pos, side, ply));
+        initSearch(ctx, pos, options);
+        int score;
+        PackedMove move = searchBestMove(ctx, side, score);
+        if (move == NO_PACKED_MOVE)
+            break;
+        makeMove(pos, move, side);
+        side = 1 - side;
+        ply++;
+    }
+    //无路可走的一方输
+    for (size_t i = first; i < samples.size(); ++i)
+        samples[i].black_won = side == sideIndex(WHITE_QUEEN);
+}
+
+bool writeTuneDataset(const string& path, const vector<TuneSample>& samples)
+{
+    TuneHeader header = {};
+    copy(TUNE_MAGIC, TUNE_MAGIC + 4, header.magic);
+    header.version = TUNE_VERSION;
+    header.board_size = (uint8_t)boardSize;
+    header.sample_count = (uint32_t)samples.size();
+    ofstream file(path, ios::binary | ios::trunc);
+    if (!file.is_open())
+    {
+        cerr << "错误：无法写入数据集 " << path << endl;
+        return false;
+    }
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)samples.data(), samples.size() * sizeof(TuneSample));
+    return file.good();
+}
+
+// --gen-data <数据集> [局数] [线程数]：自对弈采样，搜索参数取 --search
+int runGenerateData(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        cerr << "用法：--gen-data <数据集> [局数] [线程数]" << endl;
+        return 1;
+    }
+    int games = argc > 3 ? max(1, atoi(argv[3])) : 200;
+    int threads = argc > 4 ? atoi(argv[4]) : (int)max(1u, thread::hardware_concurrency());
+
+    vector<vector<TuneSample>> perGame(games);
+    atomic<int> finished(0);
+    runParallelJobs(games, threads, [&](size_t game, int)
+        {
+            withEngine(boardSize, [&](auto n) { playTuneGame<decltype(n)::value>(searchOptions, (uint32_t)game, perGame[game]); });
+            int done = ++finished;
+            if (done % 10 == 0 || done == games)
+                cout << "数据集: 已完成 " << done << " / " << games << " 局" << endl;
+        });
+
+    vector<TuneSample> samples;
+    for (const auto& game : perGame)
+        samples.insert(samples.end(), game.begin(), game.end());
+    if (!writeTuneDataset(argv[2], samples))
+        return 1;
+    cout << "数据集已写入 " << argv[2] << "，共 " << samples.size() << " 个局面" << endl;
+    return 0;
+}
+
+//Texel 调参：用 sigmoid(K * 评估分) 预测黑方胜率，最小化与实际胜负的均方误差
+struct TuneSet
+{
+    vector<array<int, EVAL_TERM_COUNT>> features;
+    vector<double> results;
+};
+
+double sigmoid(double x)
+{
+    return 1.0 / (1.0 + exp(-x));
+}
+
+//每个线程至少分到这么多局面，再少的话线程同步比计算还贵
+const size_t TUNE_MIN_CHUNK = 4096;
+
+//调参期间常驻的一组线程：误差每步都要算、K 的查找还要算上百次，不能每次都新建线程
+//runTunePool 把 0..threads-1 号分块同时交给各线程（0 号在调用线程上算），全部算完才返回
+struct TunePool
+{
+    int threads;
+    mutex lock;                 //保护以下字段
+    condition_variable start;   //有新一轮分块或要退出
+    condition_variable finish;  //本轮分块全部算完
+    function<void(int)> job;
+    uint64_t generation;
+    int pending;
+    bool stopping;
+    vector<thread> workers;
+};
+
+void startTunePool(TunePool& pool, int threads)
+{
+    pool.threads = max(1, threads);
+    pool.generation = 0;
+    pool.pending = 0;
+    pool.stopping = false;
+    for (int t = 1; t < pool.threads; ++t)
+        pool.workers.emplace_back([&pool, t]()
+            {
+                uint64_t seen = 0;
+                unique_lock<mutex> guard(pool.lock);
+                while (true)
+                {
+                    pool.start.wait(guard, [&]() { return pool.stopping || pool.generation != seen; });
+                    if (pool.stopping)
+                        return;
+                    seen = pool.generation;
+                    guard.unlock();
+                    pool.job(t);
+                    guard.lock();
+                    if (--pool.pending == 0)
+                        pool.finish.notify_one();
+                }
+            });
+}
+
+void runTunePool(TunePool& pool, const function<void(int)>& job)
+{
+    {
+        lock_guard<mutex> guard(pool.lock);
+        pool.job = job;
+        pool.pending = pool.threads - 1;
+        pool.generation++;
+    }
+    pool.start.notify_all();
+    job(0);
+    unique_lock<mutex> guard(pool.lock);
+    pool.finish.wait(guard, [&]() { return pool.pending == 0; });
+}
+
+void stopTunePool(TunePool& pool)
+{
+    {
+        lock_guard<mutex> guard(pool.lock);
+        pool.stopping = true;
+    }
+    pool.start.notify_all();
+    for (auto& w : pool.workers)
+        w.join();
+    pool.workers.clear();
+}
+
+//按线程分块计算误差，grad 非空时顺便累加对各权重的梯度
+double tuneError(const TuneSet& set, const double weights[EVAL_TERM_COUNT], double k, TunePool& pool,
+    double grad[EVAL_TERM_COUNT] = nullptr)
+{
+    size_t count = set.results.size();
+    int threads = pool.threads;
+    vector<double> errors(threads, 0.0);
+    vector<array<double, EVAL_TERM_COUNT>> grads(threads);
+    runTunePool(pool, [&](int chunk)
+        {
+            array<double, EVAL_TERM_COUNT>& g = grads[chunk];
+            g.fill(0.0);
+            for (size_t i = count * chunk / threads; i < count * (chunk + 1) / threads; ++i)
+            {
+                double score = 0;
+                for (int t = 0; t < EVAL_TERM_COUNT; ++t)
+                    score += weights[t] * set.features[i][t];
+                double p = sigmoid(k * score);
+                double diff = set.results[i] - p;
+                errors[chunk] += diff * diff;
+                if (grad)
+                    for (int t = 0; t < EVAL_TERM_COUNT; ++t)
+                        g[t] += -2.0 * diff * p * (1 - p) * k * set.features[i][t];
+            }
+        });
+    double error = 0;
+    for (int c = 0; c < threads; ++c)
+        error += errors[c];
+    if (grad)
+        for (int t = 0; t < EVAL_TERM_COUNT; ++t)
+        {
+            grad[t] = 0;
+            for (int c = 0; c < threads; ++c)
+                grad[t] += grads[c][t];
+            grad[t] /= (double)count;
+        }
+    return error / (double)count;
+}
+
+//K 只决定分数和胜率的换算比例，在对数尺度上三分查找
+double fitSigmoidScale(const TuneSet& set, const double weights[EVAL_TERM_COUNT], TunePool& pool)
+{
+    double lo = log(1e-4), hi = log(1.0);
+    for (int step = 0; step < 60; ++step)
+    {
+        double m1 = lo + (hi - lo) / 3, m2 = hi - (hi - lo) / 3;
+        if (tuneError(set, weights, exp(m1), pool) < tuneError(set, weights, exp(m2), pool))
+            hi = m2;
+        else
+            lo = m1;
+    }
+    return exp((lo + hi) / 2);
+}
+
+bool writeEvalWeights(const string& path, const int weights[EVAL_TERM_COUNT], size_t samples, double error)
+{
+    ofstream file(path, ios::trunc);
+    if (!file.is_open())
+    {
+        cerr << "错误：无法写入 " << path << endl;
+        return false;
+    }
+    file << "\xEF\xBB\xBF// 评估权重，由 finalamazon --tune 生成，不要手工修改\n";
+    file << "// " << samples << " 个局面，均方误差 " << error << "\n";
+    file << "#pragma once\n\n";
+    file << "// EVAL_SCALE 相当于一个空格的分值\n";
+    file << "constexpr int EVAL_SCALE = " << EVAL_SCALE << ";\n";
+    file << "constexpr int EVAL_WEIGHTS[] = {";
+    for (int t = 0; t < EVAL_TERM_COUNT; ++t)
+        file << (t ? ", " : " ") << weights[t];
+    file << " };\n";
+    return file.good();
+}
+
+// --tune <数据集> [迭代次数] [线程数] [输出头文件]
+//先用当前权重拟合 K，再固定 K 用 Adam 梯度下降拟合权重，结果取整后写成 constexpr 表
+int runTune(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        cerr << "用法：--tune <数据集> [迭代次数] [线程数] [输出头文件]" << endl;
+        return 1;
+    }
+    int iterations = argc > 3 ? max(1, atoi(argv[3])) : 2000;
+    int threads = argc > 4 ? atoi(argv[4]) : (int)max(1u, thread::hardware_concurrency());
+    string output = argc > 5 ? argv[5] : "eval_weights.h";
+
+    MappedFile file;
+    if (!mapFile(file, argv[2]))
+    {
+        cerr << "错误：无法打开数据集 " << argv[2] << endl;
+        return 1;
+    }
+    const TuneHeader* header = (const TuneHeader*)file.data;
+    if (file.size < sizeof(TuneHeader) || !equal(TUNE_MAGIC, TUNE_MAGIC + 4, header->magic) ||
+        header->version != TUNE_VERSION || !isSupportedBoardSize(header->board_size) ||
+        header->sample_count > (file.size - sizeof(TuneHeader)) / sizeof(TuneSample))
+    {
+        cerr << "错误：数据集文件 " << argv[2] << " 格式不正确。" << endl;
+        unmapFile(file);
+        return 1;
+    }
+
+    const TuneSample* samples = (const TuneSample*)(file.data + sizeof(TuneHeader));
+    TuneSet set;
+    set.features.resize(header->sample_count);
+    set.results.resize(header->sample_count);
+    runParallelJobs(header->sample_count, threads, [&](size_t i, int)
+        {
+            withEngine(header->board_size, [&](auto n)
+                {
+                    evalFeatures(positionFromSample<decltype(n)::value>(samples[i]), set.features[i].data());
+                });
+            set.results[i] = samples[i].black_won ? 1.0 : 0.0;
+        });
+    unmapFile(file);
+    if (set.results.empty())
+    {
+        cerr << "错误：数据集为空。" << endl;
+        return 1;
+    }
+
+    double weights[EVAL_TERM_COUNT];
+    for (int t = 0; t < EVAL_TERM_COUNT; ++t)
+        weights[t] = EVAL_WEIGHTS[t];
+
+    TunePool pool;
+    startTunePool(pool, (int)min<size_t>(max(1, threads), max<size_t>(1, set.results.size() / TUNE_MIN_CHUNK)));
+    double k = fitSigmoidScale(set, weights, pool);
+    double initial = tuneError(set, weights, k, pool);
+    cout << "局面数 " << set.results.size() << "，K = " << k << "，初始误差 " << initial << endl;
+
+    const double rate = 0.5, beta1 = 0.9, beta2 = 0.999;
+    double m[EVAL_TERM_COUNT] = {}, v[EVAL_TERM_COUNT] = {};
+    double error = initial;
+    for (int it = 1; it <= iterations; ++it)
+    {
+        double grad[EVAL_TERM_COUNT];
+        error = tuneError(set, weights, k, pool, grad);
+        for (int t = 0; t < EVAL_TERM_COUNT; ++t)
+        {
+            m[t] = beta1 * m[t] + (1 - beta1) * grad[t];
+            v[t] = beta2 * v[t] + (1 - beta2) * grad[t] * grad[t];
+            double mHat = m[t] / (1 - pow(beta1, it));
+            double vHat = v[t] / (1 - pow(beta2, it));
+            weights[t] -= rate * mHat / (sqrt(vHat) + 1e-12);
+        }
+        if (it % 200 == 0 || it == iterations)
+            cout << "迭代 " << it << "：误差 " << error << endl;
+    }
+
+    int rounded[EVAL_TERM_COUNT];
+    double fitted[EVAL_TERM_COUNT];
+    for (int t = 0; t < EVAL_TERM_COUNT; ++t)
+    {
+        rounded[t] = (int)lround(weights[t]);
+        fitted[t] = rounded[t];
+    }
+    error = tuneError(set, fitted, k, pool);
+    stopTunePool(pool);
+    cout << "取整后误差 " << error << "，权重";
+    for (int t = 0; t < EVAL_TERM_COUNT; ++t)
+        cout << " " << rounded[t];
+    cout << endl;
+    if (!writeEvalWeights(output, rounded, set.results.size(), error))
+        return 1;
+    cout << "权重已写入 " << output << "，重新编译后生效" << endl;
+    return 0;
+}
+
+//NNUE 训练：浮点网络拟合“实际胜负与手写评估胜率的加权平均”，训练完按定点格式量化
+//激活都截断在 [0,1]，量化时第一层乘 127、隐层权重乘 64、输出权重乘 256
+const double NNUE_RESULT_WEIGHT = 0.25;
+const int NNUE_BATCH_SIZE = 256;
+
+struct FloatNetwork
+{
+    int features;
+    vector<float> w1;       //特征数 × NNUE_HIDDEN
+    vector<float> b1;
+    vector<float> w2;       //NNUE_L2 × NNUE_HIDDEN
+    vector<float> b2;
+    vector<float> w3;
+    float b3;
+};
+
+void resizeFloatNetwork(FloatNetwork& net, int features)
+{
+    net.features = features;
+    net.w1.assign((size_t)features * NNUE_HIDDEN, 0.0f);
+    net.b1.assign(NNUE_HIDDEN, 0.0f);
+    net.w2.assign(NNUE_L2 * NNUE_HIDDEN, 0.0f);
+    net.b2.assign(NNUE_L2, 0.0f);
+    net.w3.assign(NNUE_L2, 0.0f);
+    net.b3 = 0.0f;
+}
+
+//棋盘的 8 种对称（旋转、翻转）不改变局面好坏，训练时随机选一种做数据增强
+int transformSquare(int sq, int size, int symmetry)
+{
+    int r = sq / size, c = sq % size;
+    if (symmetry & 1)
+        c = size - 1 - c;
+    if (symmetry & 2)
+        r = size - 1 - r;
+    if (symmetry & 4)
+        swap(r, c);
+    return r * size + c;
+}
+
+TuneSample transformSample(const TuneSample& sample, int size, int symmetry)
+{
+    TuneSample out = sample;
+    for (int side = 0; side < 2; ++side)
+        for (int i = 0; i < 4; ++i)
+            out.queens[side][i] = (uint8_t)transformSquare(sample.queens[side][i], size, symmetry);
+    out.arrows[0] = out.arrows[1] = 0;
+    for (int w = 0; w < 2; ++w)
+    {
+        uint64_t bits = sample.arrows[w];
+        while (bits)
+        {
+            int sq = transformSquare(w * 64 + popLsb(bits), size, symmetry);
+            out.arrows[sq / 64] |= 1ull << (sq % 64);
+        }
+    }
+    return out;
+}
+
+void sampleFeatures(const TuneSample& sample, int size, vector<int>& active)
+{
+    withEngine(size, [&](auto n) { nnueActiveFeatures(positionFromSample<decltype(n)::value>(sample), active); });
+}
+
+//前向计算，返回输出 z（胜率为 sigmoid(z)）；h1/h2 保存截断前的值供反向传播使用
+float floatForward(const FloatNetwork& net, const vector<int>& active, float h1[NNUE_HIDDEN], float h2[NNUE_L2])
+{
+    float a1[NNUE_HIDDEN];
+    for (int i = 0; i < NNUE_HIDDEN; ++i)
+        h1[i] = net.b1[i];
+    for (int f : active)
+        for (int i = 0; i < NNUE_HIDDEN; ++i)
+            h1[i] += net.w1[(size_t)f * NNUE_HIDDEN + i];
+    for (int i = 0; i < NNUE_HIDDEN; ++i)
+        a1[i] = min(max(h1[i], 0.0f), 1.0f);
+    float z = net.b3;
+    for (int j = 0; j < NNUE_L2; ++j)
+    {
+        h2[j] = net.b2[j];
+        for (int i = 0; i < NNUE_HIDDEN; ++i)
+            h2[j] += net.w2[j * NNUE_HIDDEN + i] * a1[i];
+        z += net.w3[j] * min(max(h2[j], 0.0f), 1.0f);
+    }
+    return z;
+}
+
+//对一个样本求梯度并累加到 grad（与 net 同形状）
+void floatBackward(const FloatNetwork& net, const vector<int>& active, const float h1[NNUE_HIDDEN],
+    const float h2[NNUE_L2], float dz, FloatNetwork& grad)
+{
+    float a1[NNUE_HIDDEN], d1[NNUE_HIDDEN] = {};
+    for (int i = 0; i < NNUE_HIDDEN; ++i)
+        a1[i] = min(max(h1[i], 0.0f), 1.0f);
+    grad.b3 += dz;
+    for (int j = 0; j < NNUE_L2; ++j)
+    {
+        float a2 = min(max(h2[j], 0.0f), 1.0f);
+        grad.w3[j] += dz * a2;
+        if (h2[j] <= 0.0f || h2[j] >= 1.0f)
+            continue;
+        float d2 = dz * net.w3[j];
+        grad.b2[j] += d2;
+        for (int i = 0; i < NNUE_HIDDEN; ++i)
+        {
+            grad.w2[j * NNUE_HIDDEN + i] += d2 * a1[i];
+            d1[i] += d2 * net.w2[j * NNUE_HIDDEN + i];
+        }
+    }
+    for (int i = 0; i < NNUE_HIDDEN; ++i)
+    {
+        if (h1[i] <= 0.0f || h1[i] >= 1.0f)
+            continue;
+        grad.b1[i] += d1[i];
+        for (int f : active)
+            grad.w1[(size_t)f * NNUE_HIDDEN + i] += d1[i];
+    }
+}
+
+//Adam 更新一组参数，更新后截断到 [-limit, limit] 以保证量化后不溢出
+void adamStep(vector<float>& params, vector<float>& grads, vector<float>& m, vector<float>& v,
+    int step, float scale, float limit)
+{
+    const float rate = 0.001f, beta1 = 0.9f, beta2 = 0.999f;
+    float c1 = 1 - pow(beta1, (float)step), c2 = 1 - pow(beta2, (float)step);
+    for (size_t i = 0; i < params.size(); ++i)
+    {
+        float g = grads[i] * scale;
+        m[i] = beta1 * m[i] + (1 - beta1) * g;
+        v[i] = beta2 * v[i] + (1 - beta2) * g * g;
+        params[i] -= rate * (m[i] / c1) / (sqrt(v[i] / c2) + 1e-8f);
+        params[i] = min(max(params[i], -limit), limit);
+        grads[i] = 0.0f;
+    }
+}
+
+//k 为分数与胜率的换算比例：浮点输出 z 对应的评估分为 z / k
+NnueNetwork quantizeNetwork(const FloatNetwork& net, int size, double k)
+{
+    NnueNetwork q = {};
+    q.boardSize = size;
+    q.inputWeights.resize(net.w1.size());
+    long limit = nnueInputLimit(size);
+    for (size_t i = 0; i < net.w1.size(); ++i)
+        q.inputWeights[i] = (int16_t)min(max(lround(net.w1[i] * 127), -limit), limit);
+    for (int i = 0; i < NNUE_HIDDEN; ++i)
+        q.inputBias[i] = (int16_t)min(max(lround(net.b1[i] * 127), -limit), limit);
+    for (int j = 0; j < NNUE_L2; ++j)
+    {
+        for (int i = 0; i < NNUE_HIDDEN; ++i)
+            q.hiddenWeights[j][i] = (int8_t)min(max(lround(net.w2[j * NNUE_HIDDEN + i] * 64), -128l), 127l);
+        q.hiddenBias[j] = (int32_t)lround(net.b2[j] * 127 * 64);
+        q.outputWeights[j] = (int16_t)lround(net.w3[j] * 256);
+    }
+    q.outputBias = (int32_t)lround(net.b3 * 127 * 256);
+    q.outputDivisor = max(1, (int32_t)lround(127 * 256 * k));
+    q.loaded = true;
+    return q;
+}
+
+// --train-nnue <数据集> [轮数] [输出网络]：每 10 局留 1 局做验证，保存验证误差最小的一轮
+//同一局的局面箭的位置高度相关，按局面划分会让验证集混进训练过的对局
+int runTrainNnue(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        cerr << "用法：--train-nnue <数据集> [轮数] [输出网络]" << endl;
+        return 1;
+    }
+    int epochs = argc > 3 ? max(1, atoi(argv[3])) : 20;
+
+    MappedFile file;
+    if (!mapFile(file, argv[2]))
+    {
+        cerr << "错误：无法打开数据集 " << argv[2] << endl;
+        return 1;
+    }
+    const TuneHeader* header = (const TuneHeader*)file.data;
+    if (file.size < sizeof(TuneHeader) || !equal(TUNE_MAGIC, TUNE_MAGIC + 4, header->magic) ||
+        header->version != TUNE_VERSION || !isSupportedBoardSize(header->board_size) ||
+        header->sample_count == 0 || header->sample_count > (file.size - sizeof(TuneHeader)) / sizeof(TuneSample))
+    {
+        cerr << "错误：数据集文件 " << argv[2] << " 格式不正确。" << endl;
+        unmapFile(file);
+        return 1;
+    }
+    int size = header->board_size;
+    string output = argc > 4 ? argv[4] : nnueFileName(size);
+    vector<TuneSample> samples((const TuneSample*)(file.data + sizeof(TuneHeader)),
+        (const TuneSample*)(file.data + sizeof(TuneHeader)) + header->sample_count);
+    unmapFile(file);
+
+    //用手写评估拟合换算比例 k，并把它的胜率作为软目标
+    TuneSet set;
+    set.features.resize(samples.size());
+    set.results.resize(samples.size());
+    vector<int> classic(samples.size());
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        withEngine(size, [&](auto n)
+            {
+                auto pos = positionFromSample<decltype(n)::value>(samples[i]);
+                evalFeatures(pos, set.features[i].data());
+                classic[i] = evaluateBoard(pos);
+            });
+        set.results[i] = samples[i].black_won ? 1.0 : 0.0;
+    }
+    double weights[EVAL_TERM_COUNT];
+    for (int t = 0; t < EVAL_TERM_COUNT; ++t)
+        weights[t] = EVAL_WEIGHTS[t];
+    TunePool pool;
+    startTunePool(pool, 1);
+    double k = fitSigmoidScale(set, weights, pool);
+    stopTunePool(pool);
+
+    //数据集里每局的局面连续存放，步数变小说明换了一局
+    vector<size_t> train, valid;
+    vector<float> targets(samples.size());
+    double classicError = 0;
+    int game = 0;
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        if (i > 0 && samples[i].ply <= samples[i - 1].ply)
+            game++;
+        double p = sigmoid(k * classic[i]);
+        targets[i] = (float)(NNUE_RESULT_WEIGHT * set.results[i] + (1 - NNUE_RESULT_WEIGHT) * p);
+        if (game % 10 == 0)
+        {
+            valid.push_back(i);
+            classicError += (set.results[i] - p) * (set.results[i] - p);
+        }
+        else
+            train.push_back(i);
+    }
+    cout << "训练 " << train.size() << " 个局面，验证 " << valid.size() << " 个局面，K = " << k
+        << "，手写评估验证误差 " << classicError / valid.size() << endl;
+
+    FloatNetwork net, grad, m, v;
+    int features = nnueFeatureCount(size);
+    resizeFloatNetwork(net, features);
+    resizeFloatNetwork(grad, features);
+    resizeFloatNetwork(m, features);
+    resizeFloatNetwork(v, features);
+    mt19937 rng(1);
+    uniform_real_distribution<float> small(-0.05f, 0.05f);
+    normal_distribution<float> hidden(0.0f, 0.25f);
+    for (float& w : net.w1)
+        w = small(rng);
+    fill(net.b1.begin(), net.b1.end(), 0.5f);
+    for (float& w : net.w2)
+        w = hidden(rng);
+    fill(net.b2.begin(), net.b2.end(), 0.5f);
+    for (float& w : net.w3)
+        w = hidden(rng);
+
+    vector<int> active;
+    float h1[NNUE_HIDDEN], h2[NNUE_L2];
+    int step = 0;
+    FloatNetwork best = net;
+    double bestError = numeric_limits<double>::max();
+    vector<float> b3(1), g3(1), m3(1), v3(1);
+    float inputLimit = (float)nnueInputLimit(size) / 127;
+    for (int epoch = 1; epoch <= epochs; ++epoch)
+    {
+        shuffle(train.begin(), train.end(), rng);
+        for (size_t start = 0; start < train.size(); start += NNUE_BATCH_SIZE)
+        {
+            size_t end = min(train.size(), start + NNUE_BATCH_SIZE);
+            for (size_t b = start; b < end; ++b)
+            {
+                size_t i = train[b];
+                sampleFeatures(transformSample(samples[i], size, rng() % 8), size, active);
+                float p = (float)sigmoid(floatForward(net, active, h1, h2));
+                floatBackward(net, active, h1, h2, 2 * (p - targets[i]) * p * (1 - p), grad);
+            }
+            float scale = 1.0f / (float)(end - start);
+            step++;
+            adamStep(net.w1, grad.w1, m.w1, v.w1, step, scale, inputLimit);
+            adamStep(net.b1, grad.b1, m.b1, v.b1, step, scale, inputLimit);
+            adamStep(net.w2, grad.w2, m.w2, v.w2, step, scale, 127.0f / 64);
+            adamStep(net.b2, grad.b2, m.b2, v.b2, step, scale, 64.0f);
+            adamStep(net.w3, grad.w3, m.w3, v.w3, step, scale, 127.0f);
+            b3[0] = net.b3;
+            g3[0] = grad.b3;
+            adamStep(b3, g3, m3, v3, step, scale, 64.0f);
+            net.b3 = b3[0];
+            grad.b3 = 0.0f;
+        }
+
+        double error = 0;
+        for (size_t i : valid)
+        {
+            sampleFeatures(samples[i], size, active);
+            double p = sigmoid(floatForward(net, active, h1, h2));
+            error += (set.results[i] - p) * (set.results[i] - p);
+        }
+        error /= valid.size();
+        cout << "第 " << epoch << " 轮：验证误差 " << error << endl;
+        if (error < bestError)
+        {
+            bestError = error;
+            best = net;
+        }
+    }
+
+    NnueNetwork quantized = quantizeNetwork(best, size, k);
+    double error = 0;
+    for (size_t i : valid)
+    {
+        NnueAccumulator acc;
+        int score = withEngine(size, [&](auto n)
+            {
+                nnueRefresh(quantized, positionFromSample<decltype(n)::value>(samples[i]), acc);
+                return nnueEvaluate(quantized, acc);
+            });
+        double p = sigmoid(k * score);
+        error += (set.results[i] - p) * (set.results[i] - p);
+    }
+    cout << "量化后验证误差 " << error / valid.size() << endl;
+    if (!writeNnueNetwork(output, quantized))
+        return 1;
+    cout << "网络已写入 " << output << endl;
+    return 0;
+}
+
+//从初始局面随机走子收集局面，供测速使用
+template <int N>
+vector<pair<EnginePosition<N>, int>> randomPositions(int count)
+{
+    vector<pair<EnginePosition<N>, int>> positions;
+    mt19937 rng(7);
+    vector<PackedMove> moves;
+    while ((int)positions.size() < count)
+    {
+        EnginePosition<N> pos = positionFromBoard<N>(initializeBoard(N));
+        int side = sideIndex(WHITE_QUEEN);
+        while ((int)positions.size() < count)
+        {
+            getAllValidMoves(pos, side, moves);
+            if (moves.empty())
+                break;
+            positions.push_back({ pos, side });
+            makeMove(pos, moves[rng() % moves.size()], side);
+            side = 1 - side;
+        }
+    }
+    return positions;
+}
 
-        FlushBatchDraw();
+//网络未加载时只测 evaluateBoard 与批量评估
+template <int N>
+void benchmarkEvalFor(int count)
+{
+    const NnueNetwork& net = nnueNetworks[N];
+    vector<pair<EnginePosition<N>, int>> positions = randomPositions<N>(count);
+    auto rate = [](uint64_t evals, chrono::steady_clock::time_point start)
+        {
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            return (uint64_t)(evals / max(seconds, 1e-9));
+        };
+    const int rounds = 20;
+    int64_t sink = 0;
 
-        MOUSEMSG m = GetMouseMsg();
-        int btnIdx = getButtonClick(m);
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r)
+        for (const auto& entry : positions)
+            sink += evaluateBoard(entry.first);
+    cout << "evaluateBoard：每秒 " << rate((uint64_t)rounds * positions.size(), start) << " 次" << endl;
 
-        if (btnIdx != -1 && m.uMsg == WM_LBUTTONDOWN)
-        {
-            EndBatchDraw();
-            if (btnIdx == 3)
-                return { {-1, -1}, {-1, -1}, {-1, -1} };
-            if (btnIdx == 0)
+    NnueAccumulator acc;
+    if (net.loaded)
+    {
+        start = chrono::steady_clock::now();
+        for (int r = 0; r < rounds; ++r)
+            for (const auto& entry : positions)
             {
-                saveGame(board, current_player);
-                continue;
+                nnueRefresh(net, entry.first, acc);
+                sink += nnueEvaluate(net, acc);
             }
-            if (btnIdx == 1)
-                return { {-2, -2}, {-2, -2}, {-2, -2} };
-            if (btnIdx == 2)
-                return { {-3, -3}, {-3, -3}, {-3, -3} };
-            continue;
-        }
+        cout << "NNUE 重算累加器：每秒 " << rate((uint64_t)rounds * positions.size(), start) << " 次" << endl;
+    }
 
-        if (m.uMsg == WM_LBUTTONDOWN)
+    //搜索中的用法：每个局面对它的着法逐一 走子 -> 评估 -> 撤销
+    vector<PackedMove> moves;
+    vector<pair<int, vector<PackedMove>>> children;
+    for (const auto& entry : positions)
+    {
+        getAllValidMoves(entry.first, entry.second, moves);
+        children.push_back({ entry.second, vector<PackedMove>(moves.begin(), moves.begin() + min<size_t>(moves.size(), 64)) });
+    }
+    uint64_t evals = 0;
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < positions.size(); ++i)
+    {
+        EnginePosition<N> pos = positions[i].first;
+        for (PackedMove move : children[i].second)
         {
-            int click_x = m.x, click_y = m.y;
-            if (click_x >= BOARD_PADDING && click_x < WINDOW_SIZE - BOARD_PADDING &&
-                click_y >= BOARD_PADDING && click_y < WINDOW_SIZE - BOARD_PADDING)
-            {
-                int c = (click_x - BOARD_PADDING) / CELL_SIZE;
-                int r = (click_y - BOARD_PADDING) / CELL_SIZE;
-                if (r >= 0 && r < BOARD_SIZE && c >= 0 && c < BOARD_SIZE)
-                    p = { r, c };
-                else
-                    continue;
-            }
-            else
-                continue;
+            makeMove(pos, move, children[i].first);
+            sink += evaluateBoard(pos);
+            undoMove(pos, move, children[i].first);
+            evals++;
         }
-        else
-            continue;
+    }
+    cout << "evaluateBoard 走子+评估+撤销：每秒 " << rate(evals, start) << " 次" << endl;
 
-        if (step == 1)
+    //前沿节点的用法：子局面写进 SoA 缓冲区后批量评估
+    if constexpr (N == 8)
+    {
+        LeafBatch batch;
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < positions.size(); ++i)
         {
-            if (board[p.row][p.col] == current_player)
+            const EnginePosition<N>& pos = positions[i].first;
+            int side = children[i].first;
+            const vector<PackedMove>& list = children[i].second;
+            size_t padded = resizeLeafBatch(batch, list.size());
+            for (size_t j = 0; j < padded && !list.empty(); ++j)
             {
-                move.queen_start = p;
-                all_possible_moves = getValidMovesForQueen(move.queen_start, board, current_player);
-                if (!all_possible_moves.empty())
-                    step = 2;
-                else
-                    showTempMessage(L"该皇后无移动空间，请选择其他皇后！");
+                PackedMove move = list[min(j, list.size() - 1)];
+                batch.queens[side][j] = pos.queens[side] ^ squareBit<uint64_t>(moveFrom(move)) ^ squareBit<uint64_t>(moveTo(move));
+                batch.queens[1 - side][j] = pos.queens[1 - side];
+                batch.arrows[j] = pos.arrows | squareBit<uint64_t>(moveArrow(move));
             }
-            else
-                showTempMessage(L"请选择您的皇后！");
+            evaluateLeafBatch(batch, 0, list.size());
+            for (size_t j = 0; j < list.size(); ++j)
+                sink += batch.scores[j];
         }
-        else if (step == 2)
+        cout << "批量评估（" << LEAF_BATCH_WIDTH << " 个局面一组）：每秒 " << rate(evals, start) << " 次" << endl;
+    }
+
+    if (!net.loaded)
+    {
+        cout << "(校验和 " << sink << ")" << endl;
+        return;
+    }
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < positions.size(); ++i)
+    {
+        EnginePosition<N> pos = positions[i].first;
+        nnueRefresh(net, pos, acc);
+        for (PackedMove move : children[i].second)
         {
-            bool valid = false;
-            for (const auto& m : all_possible_moves)
-                if (m.queen_end == p)
-                {
-                    valid = true;
-                    break;
-                }
-            if (valid)
-            {
-                move.queen_end = p;
-                step = 3;
-            }
-            else
-                showTempMessage(L"目标位置不合法！");
+            nnueApplyMove(net, acc, pos, move, children[i].first, false);
+            makeMove(pos, move, children[i].first);
+            sink += nnueEvaluate(net, acc);
+            undoMove(pos, move, children[i].first);
+            nnueApplyMove(net, acc, pos, move, children[i].first, true);
         }
-        else if (step == 3)
+    }
+    cout << "NNUE 增量更新+评估+撤销：每秒 " << rate(evals, start) << " 次" << endl;
+    cout << "(校验和 " << sink << ")" << endl;
+}
+
+// --eval-bench [局面数]：比较 evaluateBoard、批量评估与 NNUE 的评估速度
+int runEvalBenchmark(int argc, char* argv[])
+{
+    int count = argc > 2 ? max(1, atoi(argv[2])) : 20000;
+    if (!nnueNetworks[boardSize].loaded)
+        cout << "当前目录没有网络文件 " << nnueFileName(boardSize) << "，跳过 NNUE" << endl;
+    cout << "SIMD 内核：" << SIMD_KERNEL << "，" << count << " 个局面" << endl;
+    withEngine(boardSize, [&](auto n) { benchmarkEvalFor<decltype(n)::value>(count); });
+    return 0;
+}
+
+//对局服务器：一个进程承载大量对局。连接（命名管道，或 "-" 表示标准输入输出）只负责收发文本行，
+//各对局的 AI 请求排进共享线程池，已用思考时间最少的对局先算；置换表与开局库由全部线程共用
+//协议每行一条命令，着法写作 起点行 列 终点行 列 箭行 列 六个整数：
+//  new [总思考毫秒] [每步加时毫秒]   -> ok new <对局号>，从初始局面开始、白方先走；总思考时间 0 为不限
+//  move <对局号> <着法>              -> ok move <对局号>
+//  go <对局号> [本步毫秒]            -> 排队，不给本步毫秒时有时钟的对局由时间管理按剩余时间分配，
+//                                       算完并落子后回复 bestmove <对局号> <着法> <分数> <深度> <节点数> <毫秒>，
+//                                       行棋方无路可走时回复 gameover <对局号> <white|black 胜方>
+//  undo <对局号>                     -> ok undo <对局号>
+//  board <对局号>                    -> board <对局号> <white|black 行棋方> <逐行的 . W B X>
+//  close <对局号>                    -> ok close <对局号>
+//  stats                             -> stats sessions <对局数> queued <排队数> workers <线程数> searches <已完成搜索数>
+//  quit                              -> 等本连接的搜索都回复后断开
+//出错时回复 error <说明>；连接断开时关闭它创建的全部对局
+const string DEFAULT_PIPE_NAME = "\\\\.\\pipe\\amazons";
+const int SERVER_MOVE_TIME_MS = 1000;
+const size_t SERVER_TABLE_MB = 64;
+
+struct ServerConnection
+{
+    mutex lock;
+    function<void(const string&)> send;
+    bool open;
+    int pending;        //已排队或正在搜索的请求数，由 GameServer::lock 保护
+};
+
+struct ServerSession
+{
+    int id;
+    shared_ptr<ServerConnection> owner;
+    mutex lock;         //保护以下字段
+    Board board;
+    Piece player;
+    GameRecord record;
+    int64_t budgetMs;   //总思考时间，0 为不限
+    int64_t incrementMs;    //AI 每走一步加的时间
+    bool thinking;      //思考期间不接受走子、悔棋
+    bool closed;
+    atomic<int64_t> usedMs;
+    atomic<int> aiMoves;    //AI 已走的步数，用来累计加时
+};
+
+struct SearchTask
+{
+    shared_ptr<ServerSession> session;
+    Board board;
+    Piece player;
+    bool managed;       //由时间管理决定何时停止，否则到 budget.hardMs 为止
+    TimeBudget budget;
+    uint64_t sequence;
+};
+
+struct GameServer
+{
+    mutex lock;                 //保护 queue、sessions、nextId、nextSequence、stopping 和各连接的 pending
+    condition_variable ready;   //有新请求或要退出
+    condition_variable idle;    //有请求算完
+    vector<SearchTask> queue;
+    map<int, shared_ptr<ServerSession>> sessions;
+    int nextId;
+    uint64_t nextSequence;
+    bool stopping;
+    TranspositionTable table;
+    vector<thread> workers;
+    atomic<uint64_t> searches;
+};
+
+void sendLine(ServerConnection& conn, const string& line)
+{
+    lock_guard<mutex> guard(conn.lock);
+    if (conn.open)
+        conn.send(line + "\n");
+}
+
+string formatServerMove(const Move& move)
+{
+    return to_string(move.queen_start.row) + " " + to_string(move.queen_start.col) + " " +
+        to_string(move.queen_end.row) + " " + to_string(move.queen_end.col) + " " +
+        to_string(move.arrow_pos.row) + " " + to_string(move.arrow_pos.col);
+}
+
+string formatServerBoard(const Board& board)
+{
+    const char symbols[4] = { '.', 'W', 'B', 'X' };
+    string text;
+    for (const auto& row : board)
+        for (int cell : row)
+            text += symbols[cell];
+    return text;
+}
+
+const char* sideName(Piece player)
+{
+    return player == BLACK_QUEEN ? "black" : "white";
+}
+
+//取出已用思考时间最少的对局的请求，相同时先来先算
+bool takeSearchTask(GameServer& server, SearchTask& task)
+{
+    unique_lock<mutex> guard(server.lock);
+    server.ready.wait(guard, [&]() { return server.stopping || !server.queue.empty(); });
+    if (server.stopping)
+        return false;
+    auto next = min_element(server.queue.begin(), server.queue.end(),
+        [](const SearchTask& a, const SearchTask& b)
         {
-            move.arrow_pos = p;
-            bool found = false;
-            for (const auto& m : all_possible_moves)
-                if (m.queen_end == move.queen_end && m.arrow_pos == move.arrow_pos)
+            int64_t usedA = a.session->usedMs, usedB = b.session->usedMs;
+            return usedA != usedB ? usedA < usedB : a.sequence < b.sequence;
+        });
+    task = move(*next);
+    server.queue.erase(next);
+    return true;
+}
+
+//先查开局库，否则在时限内迭代加深；结果只在对局仍然存在时落子并回复
+void runServerSearch(GameServer& server, const SearchTask& task)
+{
+    auto start = chrono::steady_clock::now();
+    Move move;
+    bool found = probeOpeningBook(task.board, task.player, move);
+    int score = 0, depth = 0;
+    uint64_t nodes = 0;
+    if (!found)
+    {
+        withEngine((int)task.board.size(), [&](auto n)
+            {
+                constexpr int N = decltype(n)::value;
+                SearchContext<N> ctx;
+                initSearch(ctx, positionFromBoard<N>(task.board), task.managed ? timedSearchOptions(searchOptions) : searchOptions);
+                ctx.table = &server.table;
+                if (task.managed)
+                    setTimeBudget(ctx, task.budget);
+                else
+                    setSearchDeadline(ctx, start + chrono::milliseconds(task.budget.hardMs));
+                PackedMove best = searchBestMove(ctx, sideIndex(task.player), score);
+                nodes = ctx.nodes;
+                depth = ctx.completedDepth;
+                if (best != NO_PACKED_MOVE)
                 {
+                    move = unpackMove(best, N);
                     found = true;
-                    break;
                 }
-            if (found)
-            {
-                EndBatchDraw();
-                return move;
-            }
+            });
+    }
+    int64_t elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+
+    ServerSession& session = *task.session;
+    session.usedMs += elapsed;
+    if (found)
+        session.aiMoves++;
+    string reply;
+    {
+        lock_guard<mutex> guard(session.lock);
+        session.thinking = false;
+        if (!session.closed)
+        {
+            if (!found)
+                reply = "gameover " + to_string(session.id) + " " + sideName(opponentOf(session.player));
             else
             {
-                showTempMessage(L"射箭位置不合法！");
-                step = 1;
-                all_possible_moves.clear();
+                makeMove(session.board, move, session.player, false);
+                recordMove(session.record, move);
+                session.player = opponentOf(session.player);
+                reply = "bestmove " + to_string(session.id) + " " + formatServerMove(move) + " " + to_string(score) +
+                    " " + to_string(depth) + " " + to_string(nodes) + " " + to_string(elapsed);
             }
         }
     }
-    EndBatchDraw();
-    return move;
+    if (!reply.empty())
+        sendLine(*session.owner, reply);
+    server.searches++;
+    {
+        lock_guard<mutex> guard(server.lock);
+        session.owner->pending--;
+    }
+    server.idle.notify_all();
 }
 
-//AI逻辑
-int scoreMove(const Board& board, const Move& move, Piece player)
+void serverWorker(GameServer& server)
+{
+    SearchTask task;
+    while (takeSearchTask(server, task))
+        runServerSearch(server, task);
+}
+
+//只能操作本连接创建的对局
+shared_ptr<ServerSession> findSession(GameServer& server, const shared_ptr<ServerConnection>& conn, int id)
+{
+    lock_guard<mutex> guard(server.lock);
+    auto found = server.sessions.find(id);
+    if (found == server.sessions.end() || found->second->owner != conn)
+        return nullptr;
+    return found->second;
+}
+
+//从对局表和请求队列里移除；正在搜索的请求算完后发现 closed 就丢弃结果
+void closeSession(GameServer& server, const shared_ptr<ServerSession>& session)
 {
-    int score = 0;
-    Board temp_board = board;
-    makeMove(temp_board, move, player, false);
-    int directions[8][2] = { {0, 1}, {0, -1}, {1, 0}, {-1, 0}, {1, 1}, {-1, -1}, {1, -1}, {-1, 1} };
-    for (int i = 0; i < 8; ++i)
     {
-        int nr = move.queen_end.row + directions[i][0];
-        int nc = move.queen_end.col + directions[i][1];
-        if (isInside(nr, nc) && temp_board[nr][nc] == EMPTY)
-            score++;
+        lock_guard<mutex> guard(server.lock);
+        server.sessions.erase(session->id);
+        auto removed = remove_if(server.queue.begin(), server.queue.end(),
+            [&](const SearchTask& task) { return task.session == session; });
+        session->owner->pending -= (int)(server.queue.end() - removed);
+        server.queue.erase(removed, server.queue.end());
     }
-    return score;
+    server.idle.notify_all();
+    lock_guard<mutex> guard(session->lock);
+    session->closed = true;
+    session->thinking = false;
 }
 
-int evaluateBoard(const Board& board)
+//处理一行命令，返回 false 表示客户端要求断开
+bool handleServerCommand(GameServer& server, const shared_ptr<ServerConnection>& conn, const string& line)
 {
-    int w_mobility = 0, b_mobility = 0;
-    int directions[8][2] = { {0, 1}, {0, -1}, {1, 0}, {-1, 0}, {1, 1}, {-1, -1}, {1, -1}, {-1, 1} };
-    for (int r = 0; r < BOARD_SIZE; ++r)
+    stringstream ss(line);
+    string command;
+    if (!(ss >> command))
+        return true;
+    if (command == "quit")
+        return false;
+    if (command == "stats")
+    {
+        lock_guard<mutex> guard(server.lock);
+        sendLine(*conn, "stats sessions " + to_string(server.sessions.size()) + " queued " + to_string(server.queue.size()) +
+            " workers " + to_string(server.workers.size()) + " searches " + to_string(server.searches.load()));
+        return true;
+    }
+    if (command == "new")
     {
-        for (int c = 0; c < BOARD_SIZE; ++c)
+        int64_t budget = 0, increment = 0;
+        ss >> budget >> increment;
+        auto session = make_shared<ServerSession>();
+        session->owner = conn;
+        session->board = initializeBoard();
+        session->player = WHITE_QUEEN;
+        resetRecord(session->record, session->board, session->player);
+        session->budgetMs = max<int64_t>(budget, 0);
+        session->incrementMs = session->budgetMs > 0 ? max<int64_t>(increment, 0) : 0;
+        session->thinking = false;
+        session->closed = false;
+        session->usedMs = 0;
+        session->aiMoves = 0;
         {
-            if (board[r][c] == WHITE_QUEEN)
-            {
-                for (int i = 0; i < 8; ++i)
-                {
-                    int nr = r + directions[i][0], nc = c + directions[i][1];
-                    if (isInside(nr, nc) && board[nr][nc] == EMPTY)
-                        w_mobility++;
-                }
-            }
-            else if (board[r][c] == BLACK_QUEEN)
-            {
-                for (int i = 0; i < 8; ++i)
-                {
-                    int nr = r + directions[i][0], nc = c + directions[i][1];
-                    if (isInside(nr, nc) && board[nr][nc] == EMPTY)
-                        b_mobility++;
-                }
-            }
+            lock_guard<mutex> guard(server.lock);
+            session->id = server.nextId++;
+            server.sessions[session->id] = session;
         }
+        sendLine(*conn, "ok new " + to_string(session->id));
+        return true;
     }
-    return b_mobility - w_mobility;
-}
-
-int minimax(Board board, int depth, int alpha, int beta, bool isMaximizingPlayer) 
-{
-    Piece currentPlayer = isMaximizingPlayer ? BLACK_QUEEN : WHITE_QUEEN;
-    if (depth == 0)
-        return evaluateBoard(board);
 
-    vector<Move> possibleMoves = getAllValidMoves(board, currentPlayer);
-    if (possibleMoves.empty())
-        return isMaximizingPlayer ? -1000000 : 1000000;
-
-    if (isMaximizingPlayer)
+    int id = -1;
+    ss >> id;
+    shared_ptr<ServerSession> session = findSession(server, conn, id);
+    if (!session)
     {
-        sort(possibleMoves.begin(), possibleMoves.end(),
-            [&](const Move& a, const Move& b)
-            {
-                return scoreMove(board, a, currentPlayer) > scoreMove(board, b, currentPlayer);
-            });
+        sendLine(*conn, "error 未知命令或对局号：" + line);
+        return true;
+    }
+    if (command == "close")
+    {
+        closeSession(server, session);
+        sendLine(*conn, "ok close " + to_string(id));
+        return true;
     }
 
-    if (isMaximizingPlayer)
+    unique_lock<mutex> guard(session->lock);
+    if (command == "board")
+    {
+        sendLine(*conn, "board " + to_string(id) + " " + sideName(session->player) + " " + formatServerBoard(session->board));
+        return true;
+    }
+    if (session->thinking)
+    {
+        sendLine(*conn, "error 对局 " + to_string(id) + " 正在思考");
+        return true;
+    }
+    if (command == "move")
     {
-        int maxEval = -1000000;
-        for (const Move& move : possibleMoves)
+        Move move;
+        if (!(ss >> move.queen_start.row >> move.queen_start.col >> move.queen_end.row >> move.queen_end.col >>
+            move.arrow_pos.row >> move.arrow_pos.col) || !isMoveValid(move, session->board, session->player))
         {
-            Board temp_board = board;                         
-            makeMove(temp_board, move, currentPlayer, false); 
-            int eval = minimax(temp_board, depth - 1, alpha, beta, false);
-            maxEval = max(maxEval, eval);
-            alpha = max(alpha, maxEval);
-            if (beta <= alpha)
-                break;
+            sendLine(*conn, "error 非法着法：" + line);
+            return true;
         }
-        return maxEval;
+        makeMove(session->board, move, session->player, false);
+        recordMove(session->record, move);
+        session->player = opponentOf(session->player);
+        sendLine(*conn, "ok move " + to_string(id));
+        return true;
     }
-    else
+    if (command == "undo")
     {
-        int minEval = 1000000;
-        for (const Move& move : possibleMoves)
+        if (!undoRecordedMove(session->record, session->board, session->player))
         {
-            Board temp_board = board;                         
-            makeMove(temp_board, move, currentPlayer, false); 
-            int eval = minimax(temp_board, depth - 1, alpha, beta, true);
-            minEval = min(minEval, eval);
-            beta = min(beta, minEval);
-            if (beta <= alpha)
-                break;
+            sendLine(*conn, "error 对局 " + to_string(id) + " 没有可以悔的棋");
+            return true;
+        }
+        sendLine(*conn, "ok undo " + to_string(id));
+        return true;
+    }
+    if (command == "go")
+    {
+        int64_t moveTime = SERVER_MOVE_TIME_MS, requested;
+        bool fixed = (bool)(ss >> requested);
+        if (fixed)
+            moveTime = requested;
+        bool managed = !fixed && session->budgetMs > 0;
+        int64_t remaining = session->budgetMs + session->incrementMs * session->aiMoves - session->usedMs;
+        TimeBudget budget;
+        if (managed)
+            budget = allocateMoveTime(remaining, session->incrementMs, countEmptySquares(session->board));
+        else
+        {
+            if (session->budgetMs > 0)
+                moveTime = min(moveTime, remaining);
+            moveTime = max<int64_t>(moveTime, 0);
+            budget = { moveTime, moveTime };
+        }
+        session->thinking = true;
+        SearchTask task = { session, session->board, session->player, managed, budget, 0 };
+        guard.unlock();
+        {
+            lock_guard<mutex> serverGuard(server.lock);
+            task.sequence = server.nextSequence++;
+            server.queue.push_back(move(task));
+            conn->pending++;
         }
-        return minEval;
+        server.ready.notify_one();
+        return true;
     }
+    sendLine(*conn, "error 未知命令或对局号：" + line);
+    return true;
 }
 
-Move findBestMove(const Board& board)
+//处理一条连接上的全部命令；readLine 返回 false 表示连接已断开
+void serveConnection(GameServer& server, const function<bool(string&)>& readLine, const function<void(const string&)>& send)
 {
-    int bestVal = -1000000;
-    Move bestMove;
-    vector<Move> possibleMoves = getAllValidMoves(board, BLACK_QUEEN);
+    auto conn = make_shared<ServerConnection>();
+    conn->send = send;
+    conn->open = true;
+    conn->pending = 0;
+    string line;
+    bool quit = false;
+    while (!quit && readLine(line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        quit = !handleServerCommand(server, conn, line);
+    }
+    if (quit)
+    {
+        unique_lock<mutex> guard(server.lock);
+        server.idle.wait(guard, [&]() { return conn->pending == 0; });
+    }
 
-    sort(possibleMoves.begin(), possibleMoves.end(),
-        [&](const Move& a, const Move& b)
-        {
-            return scoreMove(board, a, BLACK_QUEEN) > scoreMove(board, b, BLACK_QUEEN);
-        });
+    vector<shared_ptr<ServerSession>> owned;
+    {
+        lock_guard<mutex> guard(server.lock);
+        for (const auto& entry : server.sessions)
+            if (entry.second->owner == conn)
+                owned.push_back(entry.second);
+    }
+    for (const auto& session : owned)
+        closeSession(server, session);
+    lock_guard<mutex> guard(conn->lock);
+    conn->open = false;
+}
 
-    for (const Move& move : possibleMoves)
+//每个客户端一个管道实例和一个收发线程，收发线程只在等数据时阻塞，搜索都在线程池里
+bool runPipeServer(GameServer& server, const string& name)
+{
+    while (true)
     {
-        Board temp_board = board;                      
-        makeMove(temp_board, move, BLACK_QUEEN, false); 
-        int moveVal = minimax(temp_board, AI_SEARCH_DEPTH - 1, -1000000, 1000000, false);
-        if (moveVal > bestVal)
+        HANDLE pipe = CreateNamedPipeA(name.c_str(), PIPE_ACCESS_DUPLEX, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
+            PIPE_UNLIMITED_INSTANCES, 4096, 4096, 0, NULL);
+        if (pipe == INVALID_HANDLE_VALUE)
         {
-            bestVal = moveVal;
-            bestMove = move;
+            cerr << "错误：无法创建命名管道 " << name << endl;
+            return false;
+        }
+        if (!ConnectNamedPipe(pipe, NULL) && GetLastError() != ERROR_PIPE_CONNECTED)
+        {
+            CloseHandle(pipe);
+            continue;
         }
+        thread([&server, pipe]()
+            {
+                string received;
+                auto readLine = [&](string& line)
+                    {
+                        size_t end;
+                        while ((end = received.find('\n')) == string::npos)
+                        {
+                            char buffer[4096];
+                            DWORD got = 0;
+                            if (!ReadFile(pipe, buffer, sizeof(buffer), &got, NULL) || got == 0)
+                                return false;
+                            received.append(buffer, got);
+                        }
+                        line = received.substr(0, end);
+                        received.erase(0, end + 1);
+                        return true;
+                    };
+                auto send = [pipe](const string& text)
+                    {
+                        DWORD written = 0;
+                        WriteFile(pipe, text.data(), (DWORD)text.size(), &written, NULL);
+                    };
+                serveConnection(server, readLine, send);
+                FlushFileBuffers(pipe);
+                DisconnectNamedPipe(pipe);
+                CloseHandle(pipe);
+            }).detach();
     }
-
-    logDebug(string("AI 最佳移动评估分数: ") + to_string(bestVal));
-    return bestMove;
 }
 
-// main函数
-int main()
+// --serve [管道名|-] [工作线程数] [置换表MB]：对局服务器，所有对局使用 --size 指定的棋盘
+int runServe(int argc, char* argv[])
 {
-    mciSendString(L"open goodluck.mp3 alias bgm", NULL, 0, NULL);
-    mciSendString(L"set bgm time format milliseconds", NULL, 0, NULL);
-    mciSendString(L"play bgm from 0 to 28000", NULL, 0, NULL);
-   
-
-    SetConsoleOutputCP(CP_UTF8);
-    Board board = initializeBoard();
+    string name = argc > 2 ? argv[2] : DEFAULT_PIPE_NAME;
+    int threads = argc > 3 ? max(1, atoi(argv[3])) : max(1, (int)thread::hardware_concurrency());
+    size_t megabytes = argc > 4 ? (size_t)max(1, atoi(argv[4])) : SERVER_TABLE_MB;
 
-    Piece currentPlayer = WHITE_QUEEN;
-    bool game_over = false;
+    for (int book_size = DEFAULT_BOARD_SIZE; book_size <= MAX_BOARD_SIZE; ++book_size)
+        if (isSupportedBoardSize(book_size))
+            openOpeningBook(openingBooks[book_size], bookFileName(book_size), book_size);
 
-    initgraph(WINDOW_SIZE + BUTTON_WIDTH + 60, WINDOW_SIZE, EW_SHOWCONSOLE);
-    setbkcolor(WHITE);
-    cleardevice();
+    GameServer server;
+    server.nextId = 1;
+    server.nextSequence = 0;
+    server.stopping = false;
+    server.searches = 0;
+    initTranspositionTable(server.table, megabytes);
+    for (int t = 0; t < threads; ++t)
+        server.workers.emplace_back(serverWorker, ref(server));
+    cerr << "服务器已启动：" << (name == "-" ? string("标准输入输出") : name) << "，" << threads << " 个搜索线程，置换表 " <<
+        megabytes << " MB，搜索参数 " << describeSearchOptions(searchOptions) << endl;
 
-    BeginBatchDraw();
+    bool ok = true;
+    if (name == "-")
+        serveConnection(server, [](string& line) { return (bool)getline(cin, line); },
+            [](const string& text) { cout << text << flush; });
+    else
+        ok = runPipeServer(server, name);
 
-    while (!game_over)
     {
-        printBoardGraphics(board);
-        FlushBatchDraw();
-
-        if (checkGameOver(board, currentPlayer))
-        {
-            Piece winner_piece = (currentPlayer == WHITE_QUEEN) ? BLACK_QUEEN : WHITE_QUEEN;
-            wchar_t winner = (winner_piece == WHITE_QUEEN) ? L'B' : L'W';
-            settextcolor(RED);
-            settextstyle(30, 0, _T("宋体"));
-            TCHAR win_text[100];
-            _stprintf_s(win_text, _T("玩家 %c 获胜！"), winner);
-            outtextxy(BOARD_PADDING, WINDOW_SIZE / 2 - 30, win_text);
-
-            settextstyle(20, 0, _T("宋体"));
-            TCHAR reason_text[100];
-            _stprintf_s(reason_text, _T("玩家 %c 无路可走"),
-                (currentPlayer == WHITE_QUEEN) ? L'W' : L'B');
-            outtextxy(BOARD_PADDING, WINDOW_SIZE / 2 + 10, reason_text);
-
-           
-            if (winner == L'B')
-            {
-                //showFireworks();
-                showBlinkText(L"恭喜黑方获胜！", BOARD_PADDING, WINDOW_SIZE / 2 + 50);
-            }
-            else
-            {
-                //showFireworks();
-                showBlinkText(L"AI获胜！", BOARD_PADDING, WINDOW_SIZE / 2 + 50);
-            }
+        lock_guard<mutex> guard(server.lock);
+        server.stopping = true;
+    }
+    server.ready.notify_all();
+    for (auto& worker : server.workers)
+        worker.join();
+    return ok ? 0 : 1;
+}
 
-            game_over = true;
-            FlushBatchDraw();
-            Sleep(3000);
+int runCommandLine(int argc, char* argv[])
+{
+    string command = argv[1];
+    if (command == "--build-db")
+        return runBuildDatabase(argc, argv);
+    if (command == "--db-stats")
+        return runDatabaseStats(argc, argv);
+    if (command == "--build-book")
+        return runBuildBook(argc, argv);
+    if (command == "--selfplay")
+        return runSelfPlay(argc, argv);
+    if (command == "--analyze")
+        return runAnalyze(argc, argv);
+    if (command == "--gen-data")
+        return runGenerateData(argc, argv);
+    if (command == "--tune")
+        return runTune(argc, argv);
+    if (command == "--train-nnue")
+        return runTrainNnue(argc, argv);
+    if (command == "--eval-bench")
+        return runEvalBenchmark(argc, argv);
+    if (command == "--serve")
+        return runServe(argc, argv);
+    cerr << "未知参数 " << command << endl;
+    cerr << "可用命令：--build-db, --db-stats, --build-book, --selfplay, --analyze, --gen-data, --tune, --train-nnue, --eval-bench, --serve" << endl;
+    return 1;
+}
 
-            settextcolor(BLACK);
-            settextstyle(20, 0, _T("宋体"));
-            outtextxy(BUTTON_AREA_X, BUTTON_AREA_Y + 5 * (BUTTON_HEIGHT + BUTTON_GAP),
-                _T("游戏结束"));
-            FlushBatchDraw();
+// main函数
+int main(int argc, char* argv[])
+{
+    SetConsoleOutputCP(CP_UTF8);
 
-            while (game_over)
+    //--size <8|10> 选择棋盘大小，--search <参数> 调整 AI 搜索，--clock <总秒数[+加秒]> 让 AI 按时钟分配用时，
+    //都可以放在命令行工具参数之前
+    int size = DEFAULT_BOARD_SIZE;
+    while (argc > 2 && (string(argv[1]) == "--size" || string(argv[1]) == "--search" || string(argv[1]) == "--clock"))
+    {
+        if (string(argv[1]) == "--size")
+        {
+            size = atoi(argv[2]);
+            if (!isSupportedBoardSize(size))
             {
-                MOUSEMSG m = GetMouseMsg();
-                if (m.uMsg == WM_LBUTTONDOWN)
-                {
-                    int btnIdx = getButtonClick(m);
-                    if (btnIdx == 2)
-                    {
-                        board = initializeBoard();
-                        currentPlayer = WHITE_QUEEN;
-                        game_over = false;
-                        break;
-                    }
-                    else if (btnIdx == 3)
-                    {
-                       
-                        break;
-                    }
-                }
+                cerr << "错误：只支持 8x8 和 10x10 棋盘。" << endl;
+                return 1;
             }
-
-            if (!game_over)
-                continue;
-            else
-                break;
         }
-
-        if (currentPlayer == WHITE_QUEEN)
+        else if (string(argv[1]) == "--clock")
         {
-            bool waiting = true;
-            while (waiting && !game_over)
-            {
-                MOUSEMSG m = GetMouseMsg();
-                int btnIdx = getButtonClick(m);
-
-                if (btnIdx != -1 && m.uMsg == WM_LBUTTONDOWN)
-                {
-                    if (btnIdx == 0)
-                    {
-                        saveGame(board, currentPlayer);
-                        printBoardGraphics(board);
-                        FlushBatchDraw();
-                    }
-                    else if (btnIdx == 1)
-                    {
-                        loadGame(board, currentPlayer);
-                        printBoardGraphics(board);
-                        FlushBatchDraw();
-                    }
-                    else if (btnIdx == 2)
-                    {
-                        board = initializeBoard();
-                        currentPlayer = WHITE_QUEEN;
-                        game_over = false;
-                        printBoardGraphics(board);
-                        FlushBatchDraw();
-                    }
-                    else if (btnIdx == 3)
-                    {
-                        game_over = true;
-                        break;
-                    }
-                }
-                else
-                {
-                    Move playerMove = getPlayerMoveByClick(board, currentPlayer);
+            if (!parseTimeControl(argv[2], gameClock))
+                return 1;
+        }
+        else if (!parseSearchOptions(argv[2], searchOptions))
+            return 1;
+        argc -= 2;
+        argv += 2;
+    }
+    setBoardSize(size);
+    for (int net_size = DEFAULT_BOARD_SIZE; net_size <= MAX_BOARD_SIZE; ++net_size)
+        if (isSupportedBoardSize(net_size))
+            loadNnueNetwork(nnueNetworks[net_size], nnueFileName(net_size), net_size);
+    if (argc > 1)
+        return runCommandLine(argc, argv);
 
-                    if (playerMove.queen_start.row == -1)
-                    {
-                        game_over = true;
-                        break;
-                    }
-                    if (playerMove.queen_start.row == -2)
-                    {
-                        loadGame(board, currentPlayer);
-                        printBoardGraphics(board);
-                        FlushBatchDraw();
-                        continue;
-                    }
-                    if (playerMove.queen_start.row == -3)
-                    {
-                        board = initializeBoard();
-                        currentPlayer = WHITE_QUEEN;
-                        game_over = false;
-                        printBoardGraphics(board);
-                        FlushBatchDraw();
-                        continue;
-                    }
+    mciSendString(L"open goodluck.mp3 alias bgm", NULL, 0, NULL);
+    mciSendString(L"set bgm time format milliseconds", NULL, 0, NULL);
+    mciSendString(L"play bgm from 0 to 28000", NULL, 0, NULL);
+   
 
-                    if (isMoveValid(playerMove, board, currentPlayer))
-                    {
-                        animateMove(playerMove.queen_start, playerMove.queen_end, currentPlayer, board);
-                        makeMove(board, playerMove, currentPlayer);
-                        currentPlayer = BLACK_QUEEN;
-                    }
-                    waiting = false;
-                }
-            }
-        }
-        else
-        {
-            settextcolor(BLACK);
-            settextstyle(20, 0, _T("宋体"));
-            outtextxy(BUTTON_AREA_X, BUTTON_AREA_Y + 4 * (BUTTON_HEIGHT + BUTTON_GAP),
-                _T("AI正在思考..."));
-            FlushBatchDraw();
+    for (int book_size = DEFAULT_BOARD_SIZE; book_size <= MAX_BOARD_SIZE; ++book_size)
+        if (isSupportedBoardSize(book_size))
+            openOpeningBook(openingBooks[book_size], bookFileName(book_size), book_size);
 
-            auto start = chrono::high_resolution_clock::now();
-            Move aiMove = findBestMove(board); 
-            auto end = chrono::high_resolution_clock::now();
-            chrono::duration<double> duration = end - start;
-            logDebug(string("AI 思考时间: ") + to_string(duration.count()) + " 秒");
+    GameState game;
+    game.board = initializeBoard();
+    game.currentPlayer = WHITE_QUEEN;
+    resetRecord(game.record, game.board, game.currentPlayer);
+    game.aiClockMs = gameClock.totalMs;
+    game.phase = PHASE_TURN_START;
+    game.quit = false;
 
-            if (aiMove.queen_start.row != -1)
-            {
-                animateMove(aiMove.queen_start, aiMove.queen_end, currentPlayer, board);
-                makeMove(board, aiMove, BLACK_QUEEN);
-                currentPlayer = WHITE_QUEEN;
-            }
-            else
-            {
-                settextcolor(RED);
-                settextstyle(30, 0, _T("宋体"));
-                outtextxy(BOARD_PADDING, WINDOW_SIZE / 2 - 30, _T("玩家 B 获胜！"));
-                settextstyle(20, 0, _T("宋体"));
-                outtextxy(BOARD_PADDING, WINDOW_SIZE / 2 + 10, _T("AI 无路可走"));
-                showFireworks();
-                showBlinkText(L"恭喜玩家 B 获胜！", BOARD_PADDING, WINDOW_SIZE / 2 + 50);
-                game_over = true;
-                FlushBatchDraw();
-                Sleep(3000);
-            }
-        }
-    }
+    openGameWindow();
 
-    if (game_over)
+    //每帧：处理全部鼠标消息 -> 推进游戏状态 -> 绘制棋盘 -> 推进动画/特效 -> 刷新脏区域
+    while (!game.quit)
     {
-        settextcolor(BLACK);
-        settextstyle(20, 0, _T("宋体"));
-        outtextxy(BUTTON_AREA_X, BUTTON_AREA_Y + 5 * (BUTTON_HEIGHT + BUTTON_GAP),
-            _T("游戏结束"));
-        FlushBatchDraw();
+        DWORD frame_start = frameClockMs();
 
-        while (true)
+        while (MouseHit() && !game.quit)
         {
             MOUSEMSG m = GetMouseMsg();
             if (m.uMsg == WM_LBUTTONDOWN)
-            {
-                int btnIdx = getButtonClick(m);
-                if (btnIdx == 2)
-                {
-                    board = initializeBoard();
-                    currentPlayer = WHITE_QUEEN;
-                    game_over = false;
-                    break;
-                }
-                else if (btnIdx == 3)
-                {
-                    break;
-                }
-            }
+                handleClick(game, m);
         }
+
+        updateGame(game);
+        renderGame(game);
+        advanceFrameTasks();
+        presentFrame();
+
+        DWORD elapsed = frameClockMs() - frame_start;
+        if (elapsed < (DWORD)FRAME_MS)
+            Sleep(FRAME_MS - elapsed);
     }
 
+    stopAiJob(game);
     EndBatchDraw();
     closegraph();
+    for (auto& book : openingBooks)
+        closeOpeningBook(book);
 
     return 0;
 }